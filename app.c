@@ -0,0 +1,677 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ncurses.h>
+#include "app.h"
+#include "timer.h"
+#include "watch.h"
+#include "cache_client.h"
+#include "stats.h"
+
+app_t *app_init(const ui_backend *backend, git_commit *head_commit, const char *filepath, const char *filename)
+{
+    app_t *app = malloc(sizeof(app_t));
+    if (!app)
+    {
+        return NULL;
+    }
+    app->backend = backend;
+    app->history_resolved = -1;
+    app->goto_pending = 0;
+    app->goto_commit = NULL;
+    app->stats_panel = NULL;
+
+    // Initialize commit graph walk
+    app->hold_walk = commit_graph_walk_init(head_commit, filename);
+    app->root = app->hold_walk->current;
+    app->history_requested = 0;
+    // working tree version is shown first, saving the file refreshes it
+    app->worktree = commit_graph_walk_add_worktree(app->hold_walk, filepath);
+    app->watch_fd = app->worktree ? file_watch_init(filepath) : -1;
+
+    // screen initialization and window setup
+    backend->start();
+    app->panes[0] = commit_display_init(LINES, COLS, 0, 0, app->hold_walk);
+    app->panes_count = 1;
+    for (int i = 0; i < APP_MAX_PANES - 1; i++)
+    {
+        pane_diff_init(&app->diffs[i]);
+    }
+    start_color();
+    use_default_colors();
+    init_pair(1, COLOR_CYAN, -1);
+    init_pair(2, COLOR_GREEN, -1);
+    init_pair(3, COLOR_RED, -1);
+    // syntax highlighting: keywords, comments, strings, numbers
+    init_pair(4, COLOR_YELLOW, -1);
+    init_pair(5, COLOR_BLUE, -1);
+    init_pair(6, COLOR_MAGENTA, -1);
+    init_pair(7, COLOR_CYAN, -1);
+    clear();
+    refresh();
+    app->active = app->panes[0];
+
+    // Display starting commit before any history search, its ancestors
+    // are resolved in app_idle and navigation works once they arrive
+    commit_display_load_buffer(app->active);
+    commit_display_update(app->active);
+    doupdate();
+    return app;
+}
+
+void app_free(app_t *app)
+{
+    if (!app)
+    {
+        return;
+    }
+    for (int i = 0; i < app->panes_count; i++)
+    {
+        commit_display_free(app->panes[i]);
+    }
+    for (int i = 0; i < APP_MAX_PANES - 1; i++)
+    {
+        pane_diff_free(&app->diffs[i]);
+    }
+    if (app->stats_panel)
+    {
+        delwin(app->stats_panel);
+    }
+    app->backend->stop();
+    git_commit_free(app->goto_commit);
+    file_watch_free(app->watch_fd);
+    commit_graph_walk_free(app->hold_walk);
+    free(app);
+}
+
+// Draw stats panel over lower right corner of the screen, it is redrawn
+// after every key and search slice so counters stay current
+static void app_draw_stats(app_t *app)
+{
+    if (!app->stats_panel)
+    {
+        return;
+    }
+    char lines[STATS_LINES][STATS_LINE_MAX];
+    size_t count = stats_format(lines, STATS_LINES);
+    werase(app->stats_panel);
+    box(app->stats_panel, 0, 0);
+    mvwprintw(app->stats_panel, 0, 2, " stats (m: close) ");
+    for (size_t i = 0; i < count; i++)
+    {
+        mvwaddnstr(app->stats_panel, i + 1, 2, lines[i], getmaxx(app->stats_panel) - 4);
+    }
+    touchwin(app->stats_panel);
+    wnoutrefresh(app->stats_panel);
+}
+
+void app_show_stats(app_t *app, int show)
+{
+    if (app->stats_panel)
+    {
+        delwin(app->stats_panel);
+        app->stats_panel = NULL;
+    }
+    if (show)
+    {
+        char lines[STATS_LINES][STATS_LINE_MAX];
+        int height = stats_format(lines, STATS_LINES) + 2;
+        int width = STATS_LINE_MAX + 4 < COLS ? STATS_LINE_MAX + 4 : COLS;
+        app->stats_panel = newwin(height < LINES ? height : LINES, width, LINES > height ? LINES - height : 0, COLS - width);
+        app_draw_stats(app);
+        return;
+    }
+    // uncover displays
+    for (int i = 0; i < app->panes_count; i++)
+    {
+        commit_display_update(app->panes[i]);
+    }
+}
+
+static int app_pane_index(app_t *app, commit_display *display)
+{
+    for (int i = 0; i < app->panes_count; i++)
+    {
+        if (app->panes[i] == display)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Recompute diffs of adjacent panes whose blobs changed and mark lines of
+// panes touching them again. Bit i of reloaded is set when pane i loaded
+// its buffer, those are redrawn whole, other marked panes only their file.
+static void app_update_diffs(app_t *app, unsigned reloaded)
+{
+    int count = app->panes_count;
+    unsigned marked = reloaded;
+    for (int i = 0; i < count - 1; i++)
+    {
+        if (pane_diff_update(&app->diffs[i], app->panes[i], app->panes[i + 1]))
+        {
+            marked |= 3u << i;
+        }
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (!(marked & (1u << i)))
+        {
+            continue;
+        }
+        commit_display_apply_diff(app->panes[i], i > 0 ? &app->diffs[i - 1] : NULL, i < count - 1 ? &app->diffs[i] : NULL, count == 2);
+        if (reloaded & (1u << i))
+        {
+            commit_display_update(app->panes[i]);
+        }
+        else
+        {
+            commit_display_update_file(app->panes[i]);
+        }
+    }
+}
+
+// Redraw after active display moved to another version, its neighbours
+// show diff against it
+static void app_active_moved(app_t *app)
+{
+    app_update_diffs(app, 1u << app_pane_index(app, app->active));
+    doupdate();
+}
+
+// Open pane next to active one showing the same version
+static void app_split(app_t *app)
+{
+    if (app->panes_count == APP_MAX_PANES)
+    {
+        beep();
+        return;
+    }
+    int index = app_pane_index(app, app->active) + 1;
+    app->hold_walk->current = app->active->walk->current;
+    commit_display *display = commit_display_init(LINES, COLS, 0, 0, app->hold_walk);
+    commit_display_load_buffer(display);
+    // diff of active pane with its right neighbour now belongs to new pane,
+    // which shows the same blob, so it stays valid
+    memmove(&app->panes[index + 1], &app->panes[index], (app->panes_count - index) * sizeof(commit_display *));
+    memmove(&app->diffs[index], &app->diffs[index - 1], (app->panes_count - index) * sizeof(pane_diff));
+    pane_diff_init(&app->diffs[index - 1]);
+    app->panes[index] = display;
+    app->panes_count++;
+    handle_resize(app->panes, app->panes_count);
+    app_update_diffs(app, (1u << app->panes_count) - 1);
+    doupdate();
+}
+
+// Close active pane, its neighbours are diffed against each other
+static void app_close_active(app_t *app)
+{
+    int count = app->panes_count;
+    if (count == 1)
+    {
+        beep();
+        return;
+    }
+    int index = app_pane_index(app, app->active);
+    int removed = index < count - 1 ? index : index - 1;
+    if (index > 0 && index < count - 1)
+    {
+        pane_diff_free(&app->diffs[index - 1]);
+    }
+    pane_diff_free(&app->diffs[removed]);
+    memmove(&app->diffs[removed], &app->diffs[removed + 1], (count - 2 - removed) * sizeof(pane_diff));
+    pane_diff_init(&app->diffs[count - 2]);
+    commit_display_free(app->active);
+    memmove(&app->panes[index], &app->panes[index + 1], (count - 1 - index) * sizeof(commit_display *));
+    app->panes_count--;
+    app->active = app->panes[index < app->panes_count ? index : app->panes_count - 1];
+    handle_resize(app->panes, app->panes_count);
+    app_update_diffs(app, (1u << app->panes_count) - 1);
+    doupdate();
+}
+
+// Start jump of active display to a date (YYYY-MM-DD [HH:MM], local time,
+// date alone means end of that day) or to a commit given by hex prefix.
+// Found versions are jumped to directly, otherwise history is resolved in
+// app_idle until the target is found. Returns 0 if input is not valid or
+// commit is not reachable from HEAD.
+static void app_goto_cancel(app_t *app)
+{
+    app->goto_pending = 0;
+    git_commit_free(app->goto_commit);
+    app->goto_commit = NULL;
+}
+
+static int app_goto(app_t *app, const char *input)
+{
+    struct tm date = {0};
+    int hour = 23;
+    int minute = 59;
+    int second = 59;
+    size_t length = strlen(input);
+    if (sscanf(input, "%d-%d-%d", &date.tm_year, &date.tm_mon, &date.tm_mday) == 3)
+    {
+        if (sscanf(input, "%*d-%*d-%*d %d:%d", &hour, &minute) == 2)
+        {
+            second = 0;
+        }
+        date.tm_year -= 1900;
+        date.tm_mon -= 1;
+        date.tm_hour = hour;
+        date.tm_min = minute;
+        date.tm_sec = second;
+        date.tm_isdst = -1;
+        time_t time = mktime(&date);
+        if (time == (time_t)-1)
+        {
+            return 0;
+        }
+        app_goto_cancel(app);
+        app->goto_time = time;
+        app->goto_pending = 1;
+        return 1;
+    }
+
+    git_oid prefix;
+    if (length < GIT_OID_MINPREFIXLEN || length > GIT_OID_HEXSZ || strspn(input, "0123456789abcdefABCDEF") != length ||
+        git_oid_fromstrn(&prefix, input, length) != 0)
+    {
+        return 0;
+    }
+    // prefix is resolved in the whole repository, so it is ambiguous the
+    // same way as in git even when only one version matches
+    git_repository *repo = git_commit_owner(app->root->commit);
+    git_commit *commit = NULL;
+    if (git_commit_lookup_prefix(&commit, repo, &prefix, length) != 0)
+    {
+        return 0;
+    }
+    commit_graph_node_t *node = version_index_find_prefix(app->hold_walk->versions, git_commit_id(commit), GIT_OID_HEXSZ);
+    if (node)
+    {
+        git_commit_free(commit);
+        app->active->walk->current = node;
+        app->active->menu_state = 0;
+        app->active->y_offset = 0;
+        commit_display_load_buffer(app->active);
+        app_active_moved(app);
+        return 1;
+    }
+    // commit which did not change the file shows version it has, found in
+    // app_idle by its blob, it has to be reachable from HEAD
+    git_tree *tree = NULL;
+    const git_tree_entry *entry = NULL;
+    int reachable = git_graph_descendant_of(repo, git_commit_id(app->root->commit), git_commit_id(commit)) == 1 &&
+                    git_commit_tree(&tree, commit) == 0 &&
+                    (entry = git_tree_entry_byname(tree, commit_graph_node_name(app->root)));
+    if (!reachable)
+    {
+        git_tree_free(tree);
+        git_commit_free(commit);
+        return 0;
+    }
+    app_goto_cancel(app);
+    git_oid_cpy(&app->goto_blob, git_tree_entry_id(entry));
+    git_tree_free(tree);
+    app->goto_commit = commit;
+    app->goto_pending = 1;
+    return 1;
+}
+
+// Handle one key press, returns 0 when app should quit
+int app_handle_key(app_t *app, int key)
+{
+    switch (key)
+    {
+    case 'q':
+        return 0;
+    case ERR:
+        // no key pressed, only continue searching
+        break;
+    case 'x':
+        app_goto_cancel(app);
+        commit_graph_search_pause(commit_graph_node_commit(app->active->walk->current));
+        commit_display_update_info(app->active);
+        doupdate();
+        break;
+    case 'c':
+        commit_graph_search_resume(commit_graph_node_commit(app->active->walk->current));
+        break;
+    case KEY_RESIZE:
+        handle_resize(app->panes, app->panes_count);
+        if (app->stats_panel)
+        {
+            app_show_stats(app, 1);
+        }
+        break;
+    case 'm':
+        app_show_stats(app, !app->stats_panel);
+        doupdate();
+        break;
+    case 'i':
+        app->active = app->panes[(app_pane_index(app, app->active) + 1) % app->panes_count];
+        break;
+    case 's':
+        app_split(app);
+        break;
+    case 'u':
+        app_close_active(app);
+        break;
+    default:
+        if (app->active->menu_state)
+        {
+            switch (key) // handle h, j, k, l on menu display
+            {
+            case 'h':
+            case KEY_LEFT:
+                commit_graph_walk_to_ancestor(app->active->walk, app->active->menu_state - 1);
+                app->active->menu_state = 0;
+                app->active->y_offset = 0;
+                commit_display_load_buffer(app->active);
+                app_active_moved(app);
+                doupdate();
+                break;
+            case KEY_RIGHT:
+            case 'l':
+                app->active->menu_state = 0;
+                commit_display_update_file(app->active);
+                doupdate();
+                break;
+            case KEY_DOWN:
+            case 'j':
+                if (app->active->menu_state < app->active->walk->current->ancestor_count)
+                {
+                    app->active->menu_state++;
+                    commit_display_update_menu(app->active);
+                    doupdate();
+                }
+                else
+                {
+                    beep();
+                }
+                break;
+            case KEY_UP:
+            case 'k':
+                if (app->active->menu_state > 1)
+                {
+                    app->active->menu_state--;
+                    commit_display_update_menu(app->active);
+                    doupdate();
+                }
+                else
+                {
+                    beep();
+                }
+                break;
+            }
+        }
+        else
+        {
+            switch (key) // handle h, j, k, l on file display
+            {
+            case KEY_LEFT:
+            case 'h':
+                if (app->active->walk->current->ancestor_count > 1)
+                {
+                    app->active->menu_state = 1;
+                    commit_display_update_menu(app->active);
+                    doupdate();
+                }
+                else if (app->active->walk->current->ancestor_count > 0)
+                {
+                    commit_graph_walk_to_ancestor(app->active->walk, 0);
+                    app->active->y_offset = 0;
+                    commit_display_load_buffer(app->active);
+                    app_active_moved(app);
+                    doupdate();
+                }
+                else
+                {
+                    beep();
+                }
+                break;
+            case KEY_RIGHT:
+            case 'l':
+                if (app->active->walk->current->descendant)
+                {
+                    commit_graph_walk_to_descendant(app->active->walk);
+                    app->active->y_offset = 0;
+                    commit_display_load_buffer(app->active);
+                    app_active_moved(app);
+                    doupdate();
+                }
+                else
+                {
+                    beep();
+                }
+                break;
+            case KEY_DOWN:
+            case 'j':
+                if (commit_display_scroll(app->active, 1))
+                {
+                    commit_display_update(app->active);
+                    doupdate();
+                }
+                else
+                {
+                    beep();
+                }
+                break;
+            case KEY_UP:
+            case 'k':
+                if (commit_display_scroll(app->active, -1))
+                {
+                    commit_display_update(app->active);
+                    doupdate();
+                }
+                else
+                {
+                    beep();
+                }
+                break;
+            case KEY_NPAGE:
+            case KEY_PPAGE:
+                if (commit_display_scroll_page(app->active, key == KEY_NPAGE ? 1 : -1))
+                {
+                    commit_display_update(app->active);
+                    doupdate();
+                }
+                else
+                {
+                    beep();
+                }
+                break;
+            case '>':
+            case '<':
+                if (commit_display_scroll_horizontal(app->active, key == '>' ? 8 : -8))
+                {
+                    commit_display_update(app->active);
+                    doupdate();
+                }
+                else
+                {
+                    beep();
+                }
+                break;
+            case 'w':
+                commit_display_toggle_wrap(app->active);
+                commit_display_update(app->active);
+                doupdate();
+                break;
+            case '/':
+            {
+                // search is updated while typing, cancelling restores previous one
+                char query[sizeof(app->active->search.query)];
+                char previous[sizeof(app->active->search.query)];
+                int previous_offset = app->active->y_offset;
+                strcpy(previous, app->active->search.query);
+                if (!commit_display_prompt(app->active, "/", query, sizeof(query), commit_display_search_update, app->backend->read_key))
+                {
+                    commit_display_search_update(app->active, previous);
+                    app->active->y_offset = previous_offset;
+                }
+                commit_display_update(app->active);
+                doupdate();
+                break;
+            }
+            case 'n':
+            case 'N':
+                if (commit_display_search_jump(app->active, key == 'n' ? 1 : -1))
+                {
+                    commit_display_update(app->active);
+                    doupdate();
+                }
+                else
+                {
+                    beep();
+                }
+                break;
+            case 't':
+            {
+                char target[48];
+                if (commit_display_prompt(app->active, "Go to date (YYYY-MM-DD [HH:MM]) or commit: ", target, sizeof(target), NULL, app->backend->read_key) && !app_goto(app, target))
+                {
+                    beep();
+                }
+                commit_display_update(app->active);
+                doupdate();
+                break;
+            }
+            case 'g':
+            {
+                char line[16];
+                if (commit_display_prompt(app->active, "Go to line: ", line, sizeof(line), NULL, app->backend->read_key) && !commit_display_goto_line(app->active, atoi(line)))
+                {
+                    beep();
+                }
+                commit_display_update(app->active);
+                doupdate();
+                break;
+            }
+            }
+        }
+        break;
+    }
+
+    return 1;
+}
+
+// Reload working tree file after it was saved. Only its blob is read and
+// diffed again and only displays showing it, or diffed against it, are
+// redrawn.
+void app_refresh_worktree(app_t *app)
+{
+    if (commit_graph_node_reload_worktree(app->worktree) != 1)
+    {
+        return;
+    }
+    unsigned reloaded = 0;
+    for (int i = 0; i < app->panes_count; i++)
+    {
+        if (app->panes[i]->walk->current == app->worktree)
+        {
+            commit_display_load_buffer(app->panes[i]);
+            reloaded |= 1u << i;
+        }
+    }
+    if (reloaded)
+    {
+        app_update_diffs(app, reloaded);
+    }
+}
+
+// Ask cache daemon once for history of root, after the first paint. When
+// daemon already resolved it, it replaces in process search.
+static void app_request_history(app_t *app)
+{
+    if (app->history_requested)
+    {
+        return;
+    }
+    app->history_requested = 1;
+    cache_history_t history;
+    if (!app->root->search && !app->root->ancestors_fetched &&
+        cache_client_history(git_commit_owner(app->root->commit), git_commit_id(app->root->commit),
+                             commit_graph_node_name(app->root), &history) == 0)
+    {
+        commit_graph_node_add_history(app->root, history.commits, history.blobs, history.descendants, history.count);
+        cache_history_free(&history);
+    }
+}
+
+// Background work between key presses, continues ancestor search of shown
+// commits and picks up saves of working tree file. Returns 1 while there
+// is more to do.
+int app_idle(app_t *app)
+{
+    app_request_history(app);
+    if (app->watch_fd >= 0 && file_watch_changed(app->watch_fd, commit_graph_node_name(app->worktree)))
+    {
+        app_refresh_worktree(app);
+    }
+    int searching = 0;
+    if (app->goto_pending)
+    {
+        int result = app->goto_commit ? commit_display_goto_commit_step(app->active, app->goto_commit, &app->goto_blob)
+                                      : commit_display_goto_step(app->active, app->goto_time);
+        if (result != 1)
+        {
+            app_goto_cancel(app);
+        }
+        searching = app->goto_pending;
+        if (result == 0)
+        {
+            app_active_moved(app);
+        }
+        else if (result < 0)
+        {
+            beep();
+        }
+    }
+    // panes showing the same commit share its search, it runs once per idle
+    // and the other panes only show its progress
+    for (int i = 0; i < app->panes_count; i++)
+    {
+        int shared = 0;
+        for (int j = 0; j < i; j++)
+        {
+            shared |= commit_graph_node_commit(app->panes[j]->walk->current) == commit_graph_node_commit(app->panes[i]->walk->current);
+        }
+        if (shared)
+        {
+            commit_display_update_info(app->panes[i]);
+        }
+        else
+        {
+            searching |= commit_display_search_step(app->panes[i]);
+        }
+    }
+    if (app->history_resolved < 0 && app->root->ancestors_fetched)
+    {
+        app->history_resolved = timer_now_ms();
+    }
+    app_draw_stats(app);
+    doupdate();
+    return searching;
+}
+
+// User input loop, while ancestor search is unfinished reading keys doesn't
+// block and search runs in slices between key presses
+void app_run(app_t *app)
+{
+    int searching = commit_graph_search_active(commit_graph_node_commit(app->panes[0]->walk->current));
+    while (1)
+    {
+        // file watch wakes only this wait, prompts keep blocking on keys
+        app->backend->wake_on(app->watch_fd);
+        int key = app->backend->read_key(searching ? 0 : -1);
+        app->backend->wake_on(-1);
+        if (!app_handle_key(app, key))
+        {
+            break;
+        }
+        searching = app_idle(app);
+    }
+}
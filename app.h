@@ -0,0 +1,40 @@
+#ifndef APP_H
+#define APP_H
+
+#include <git2.h>
+#include <ncurses.h>
+#include "commit_graph_walk.h"
+#include "windows.h"
+#include "backend.h"
+
+#define APP_MAX_PANES 6
+
+typedef struct
+{
+    const ui_backend *backend;
+    commit_graph_walk_t *hold_walk; // owns the graph, displays only move over it
+    commit_graph_node_t *root;
+    commit_display *panes[APP_MAX_PANES]; // side by side, older versions usually left
+    pane_diff diffs[APP_MAX_PANES - 1];   // diffs[i] is between panes i and i + 1
+    int panes_count;
+    commit_display *active;
+    double history_resolved;        // timer_now_ms when root ancestors were found, -1 before
+    int history_requested;          // cache daemon was asked for history of root
+    commit_graph_node_t *worktree;  // working tree version above root, NULL if file can't be read
+    int watch_fd;                   // inotify watch of working tree file, -1 if not watched
+    int goto_pending;               // set while active display goes back to goto_time or goto_commit
+    git_time_t goto_time;
+    git_commit *goto_commit;        // commit whose version is looked for, NULL for date goto
+    git_oid goto_blob;              // blob of the file in goto_commit
+    WINDOW *stats_panel;            // memory and timing stats over displays, NULL when hidden
+} app_t;
+
+app_t *app_init(const ui_backend *backend, git_commit *head_commit, const char *filepath, const char *filename);
+void app_free(app_t *app);
+int app_handle_key(app_t *app, int key);
+int app_idle(app_t *app);
+void app_refresh_worktree(app_t *app);
+void app_show_stats(app_t *app, int show);
+void app_run(app_t *app);
+
+#endif
@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <poll.h>
+#include <unistd.h>
+#include <ncurses.h>
+#include "backend.h"
+
+// Descriptor waking read_key of ncurses backend, e.g. file watch
+static int ncurses_wake_fd = -1;
+
+static void ncurses_start(void)
+{
+    initscr();
+    cbreak();
+    noecho();
+    curs_set(0);
+    keypad(stdscr, TRUE);
+}
+
+static void ncurses_stop(void)
+{
+    clear();
+    nocbreak();
+    attrset(A_NORMAL);
+    endwin();
+    system("stty sane");
+}
+
+static int ncurses_read_key(int timeout_ms)
+{
+    // ncurses reads input byte by byte, so pending keys are visible to poll
+    if (ncurses_wake_fd >= 0 && timeout_ms != 0)
+    {
+        struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {ncurses_wake_fd, POLLIN, 0}};
+        if (poll(fds, 2, timeout_ms) > 0 && !(fds[0].revents & POLLIN))
+        {
+            return ERR;
+        }
+    }
+    timeout(timeout_ms);
+    return getch();
+}
+
+static void ncurses_wake_on(int fd)
+{
+    ncurses_wake_fd = fd;
+}
+
+const ui_backend ncurses_backend = {"ncurses", ncurses_start, ncurses_stop, ncurses_read_key, ncurses_wake_on};
+
+// Headless screen, output goes to /dev/null and only ncurses' in-memory
+// copy of the screen is kept
+static SCREEN *headless_screen = NULL;
+static FILE *headless_output = NULL;
+static FILE *headless_input = NULL;
+static int headless_columns = 160;
+static int headless_lines = 48;
+static int *headless_keys = NULL;
+static size_t headless_keys_count = 0;
+static size_t headless_keys_next = 0;
+
+void headless_backend_set_size(int columns, int lines)
+{
+    headless_columns = columns;
+    headless_lines = lines;
+}
+
+// Append keys returned by read_key of headless backend
+void headless_backend_feed(const int *keys, size_t count)
+{
+    headless_keys = realloc(headless_keys, (headless_keys_count + count) * sizeof(int));
+    if (!headless_keys)
+    {
+        perror("Failed to reallocate memory for headless keys");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        headless_keys[headless_keys_count++] = keys[i];
+    }
+}
+
+static void headless_start(void)
+{
+    headless_output = fopen("/dev/null", "w");
+    headless_input = fopen("/dev/null", "r");
+    headless_screen = newterm("xterm-256color", headless_output, headless_input);
+    if (!headless_screen)
+    {
+        fprintf(stderr, "Failed to create headless screen\n");
+        exit(EXIT_FAILURE);
+    }
+    set_term(headless_screen);
+    resizeterm(headless_lines, headless_columns);
+    cbreak();
+    noecho();
+    curs_set(0);
+    keypad(stdscr, TRUE);
+}
+
+static void headless_stop(void)
+{
+    endwin();
+    delscreen(headless_screen);
+    fclose(headless_output);
+    fclose(headless_input);
+    free(headless_keys);
+    headless_keys = NULL;
+    headless_keys_count = headless_keys_next = 0;
+}
+
+// Keys never arrive later, so an empty queue returns ERR without waiting
+static int headless_read_key(int timeout_ms)
+{
+    (void)timeout_ms;
+    if (headless_keys_next >= headless_keys_count)
+    {
+        return ERR;
+    }
+    return headless_keys[headless_keys_next++];
+}
+
+// Queue never waits, so there is nothing to wake
+static void headless_wake_on(int fd)
+{
+    (void)fd;
+}
+
+const ui_backend headless_backend = {"headless", headless_start, headless_stop, headless_read_key, headless_wake_on};
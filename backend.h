@@ -0,0 +1,27 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <stddef.h>
+
+/*
+Rendering and input backend of the app. Both backends draw with ncurses
+windows, the ncurses one on the real terminal and the headless one on an
+in-memory screen with keys taken from a queue, which lets key sequences
+be replayed without a terminal.
+*/
+typedef struct
+{
+    const char *name;
+    void (*start)(void);           // initialize screen
+    void (*stop)(void);            // restore terminal
+    int (*read_key)(int timeout_ms); // next key or ERR if none came in timeout, -1 blocks
+    void (*wake_on)(int fd);         // read_key also returns ERR when fd becomes readable, -1 stops
+} ui_backend;
+
+extern const ui_backend ncurses_backend;
+extern const ui_backend headless_backend;
+
+void headless_backend_set_size(int columns, int lines);
+void headless_backend_feed(const int *keys, size_t count);
+
+#endif
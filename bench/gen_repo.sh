@@ -0,0 +1,67 @@
+#!/bin/sh
+# Generate a test repository for qdiff_replay and other benchmarks.
+# Usage: bench/gen_repo.sh <dir> [commits] [change_every] [lines] [files] [merge_every]
+# Every commit changes other.txt, file.c is changed every change_every
+# commits so history search has long stretches of unchanged file to cross.
+# files adds that many unchanged files next to file.c, so the root tree
+# grows past libgit2's default 4 KiB tree cache limit.
+# merge_every makes every merge_every-th commit a merge changing file.c.
+# Its side branch of merge_every / 2 commits forks right after the
+# previous merge and changes file.c in its first commit, so searches from
+# the merge and from the side branch both cross the same mainline commits.
+set -e
+
+dir=${1:?missing target directory}
+commits=${2:-20000}
+change_every=${3:-500}
+lines=${4:-2000}
+files=${5:-0}
+merge_every=${6:-0}
+if [ "$merge_every" -eq 1 ]; then
+    echo "merge_every has to be 0 or at least 2" >&2
+    exit 1
+fi
+
+mkdir -p "$dir"
+cd "$dir"
+git init -q .
+awk -v commits="$commits" -v every="$change_every" -v lines="$lines" -v files="$files" -v merge_every="$merge_every" '
+function write_file(version, side) {
+    printf "M 100644 inline file.c\ndata <<EOF\n"
+    for (l = 0; l < lines; l++)
+        printf "int value_%d = %d; /* version %d%s */\n", l, (l * 7 + version) % 1000, version, side
+    printf "EOF\n"
+}
+BEGIN {
+    side_mark = commits
+    for (i = 1; i <= commits; i++) {
+        merge = merge_every > 0 && i % merge_every == 0
+        if (merge) {
+            fork = i - merge_every + 1
+            for (s = 1; s <= int(merge_every / 2); s++) {
+                printf "commit refs/heads/side\nmark :%d\n", ++side_mark
+                printf "committer bench <bench@example.com> %d +0000\n", 1000000000 + (fork + s) * 600 + 300
+                printf "data <<EOF\nside %d of merge %d\nEOF\n", s, i
+                printf "from :%d\n", s == 1 ? fork : side_mark - 1
+                if (s == 1)
+                    write_file(i, " side")
+                printf "M 100644 inline side.txt\ndata <<EOF\n%d\nEOF\n\n", side_mark
+            }
+        }
+        printf "commit refs/heads/master\nmark :%d\n", i
+        printf "committer bench <bench@example.com> %d +0000\n", 1000000000 + i * 600
+        printf "data <<EOF\ncommit %d\nEOF\n", i
+        if (i > 1)
+            printf "from :%d\n", i - 1
+        if (merge)
+            printf "merge :%d\n", side_mark
+        if (i == 1 || i % every == 0 || merge)
+            write_file(i, "")
+        if (i == 1)
+            for (f = 0; f < files; f++)
+                printf "M 100644 inline unchanged_source_file_%05d.c\ndata <<EOF\n%d\nEOF\n", f, f
+        printf "M 100644 inline other.txt\ndata <<EOF\n%d\nEOF\n\n", i
+    }
+}' | git fast-import --quiet
+git checkout -q master
+git commit-graph write --reachable --changed-paths
@@ -0,0 +1,249 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "cache_client.h"
+
+// Daemon answering slower than this is given up and work is done in process
+#define CACHE_TIMEOUT_SEC 2
+
+static int cache_fd = -1;
+static FILE *cache_input = NULL; // buffered reading of answers from cache_fd
+
+// Socket of the daemon, QDIFF_SOCKET overrides default per user location
+void cache_socket_path(char *out, size_t size)
+{
+    const char *path = getenv("QDIFF_SOCKET");
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (path && *path)
+    {
+        snprintf(out, size, "%s", path);
+    }
+    else if (runtime_dir && *runtime_dir)
+    {
+        snprintf(out, size, "%s/qdiffd.sock", runtime_dir);
+    }
+    else
+    {
+        snprintf(out, size, "/tmp/qdiffd-%u.sock", (unsigned)getuid());
+    }
+}
+
+// Connect to running daemon, returns 0 on success and -1 when there is none
+int cache_client_connect(void)
+{
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    cache_socket_path(address.sun_path, sizeof(address.sun_path));
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    struct timeval timeout = {CACHE_TIMEOUT_SEC, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    cache_input = fdopen(fd, "r");
+    if (!cache_input)
+    {
+        close(fd);
+        return -1;
+    }
+    cache_fd = fd;
+    return 0;
+}
+
+void cache_client_disconnect(void)
+{
+    if (cache_input)
+    {
+        fclose(cache_input); // closes cache_fd too
+    }
+    cache_input = NULL;
+    cache_fd = -1;
+}
+
+// Send request line, on failure connection is dropped so the rest of the
+// session runs in process
+static int cache_send(const char *request)
+{
+    if (cache_fd < 0)
+    {
+        return -1;
+    }
+    size_t length = strlen(request);
+    size_t sent = 0;
+    while (sent < length)
+    {
+        ssize_t written = send(cache_fd, request + sent, length - sent, MSG_NOSIGNAL);
+        if (written <= 0)
+        {
+            cache_client_disconnect();
+            return -1;
+        }
+        sent += written;
+    }
+    return 0;
+}
+
+// Send request line and read first line of answer
+static int cache_request(const char *request, char *answer, size_t size)
+{
+    if (cache_send(request) != 0)
+    {
+        return -1;
+    }
+    if (!fgets(answer, size, cache_input))
+    {
+        cache_client_disconnect();
+        return -1;
+    }
+    return 0;
+}
+
+// Get resolved history of path starting at commit. Returns 0 when it was
+// filled, 1 when daemon doesn't have it yet and -1 on failure.
+int cache_client_history(git_repository *repo, const git_oid *commit, const char *path, cache_history_t *history)
+{
+    char request[4096 + 128];
+    char answer[128];
+    snprintf(request, sizeof(request), "HISTORY %s\t%s\t%s\n", git_repository_path(repo), git_oid_tostr_s(commit), path);
+    if (cache_request(request, answer, sizeof(answer)) != 0)
+    {
+        return -1;
+    }
+    if (strcmp(answer, "MISS\n") == 0)
+    {
+        return 1;
+    }
+    size_t count;
+    if (sscanf(answer, "HISTORY %zu", &count) != 1 || count == 0)
+    {
+        return -1;
+    }
+    history->commits = malloc(count * sizeof(git_oid));
+    history->blobs = malloc(count * sizeof(git_oid));
+    history->descendants = malloc(count * sizeof(long));
+    history->count = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        char hex[GIT_OID_HEXSZ + 1];
+        char blob_hex[GIT_OID_HEXSZ + 1];
+        long descendant;
+        if (!history->commits || !history->blobs || !history->descendants || !fgets(answer, sizeof(answer), cache_input) ||
+            sscanf(answer, "%40s %ld %40s", hex, &descendant, blob_hex) != 3 ||
+            git_oid_fromstrn(&history->commits[i], hex, strlen(hex)) != 0 ||
+            git_oid_fromstrn(&history->blobs[i], blob_hex, strlen(blob_hex)) != 0)
+        {
+            // rest of answer can't be skipped reliably
+            cache_history_free(history);
+            cache_client_disconnect();
+            return -1;
+        }
+        history->descendants[i] = descendant;
+        history->count++;
+    }
+    return 0;
+}
+
+void cache_history_free(cache_history_t *history)
+{
+    free(history->commits);
+    free(history->blobs);
+    free(history->descendants);
+    history->commits = NULL;
+    history->blobs = NULL;
+    history->descendants = NULL;
+    history->count = 0;
+}
+
+// Read answer line passing a file descriptor, which comes with its first
+// byte. Answers are read whole before next request, so nothing of this one
+// is buffered in cache_input. Returns received descriptor or -1.
+static int cache_receive_fd(char *answer, size_t size)
+{
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec vector = {answer, 1};
+    struct msghdr message = {0};
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    if (recvmsg(cache_fd, &message, MSG_CMSG_CLOEXEC) != 1)
+    {
+        cache_client_disconnect();
+        return -1;
+    }
+    answer[1] = '\0';
+    int fd = -1;
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    if (header && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+    {
+        memcpy(&fd, CMSG_DATA(header), sizeof(int));
+    }
+    if (*answer != '\n' && !fgets(answer + 1, size - 1, cache_input))
+    {
+        cache_client_disconnect();
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+// Map blob inflated by daemon, mapping is released with cache_client_release.
+// Returns 0 on success.
+int cache_client_blob(git_repository *repo, const git_oid *oid, void **mapping, size_t *size)
+{
+    char request[4096 + 128];
+    char answer[256];
+    snprintf(request, sizeof(request), "BLOB %s\t%s\n", git_repository_path(repo), git_oid_tostr_s(oid));
+    if (cache_send(request) != 0)
+    {
+        return -1;
+    }
+    int fd = cache_receive_fd(answer, sizeof(answer));
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (sscanf(answer, "FD %zu", size) != 1)
+    {
+        close(fd);
+        return -1;
+    }
+    *mapping = NULL;
+    if (*size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+    void *data = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return -1;
+    }
+    *mapping = data;
+    return 0;
+}
+
+void cache_client_release(void *mapping, size_t size)
+{
+    if (mapping)
+    {
+        munmap(mapping, size);
+    }
+}
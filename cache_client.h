@@ -0,0 +1,44 @@
+#ifndef CACHE_CLIENT_H
+#define CACHE_CLIENT_H
+
+#include <stddef.h>
+#include <git2.h>
+
+/*
+Client of qdiffd, optional local daemon keeping repositories, resolved
+file histories and inflated blobs for all qdiff processes of the host.
+Requests are text lines over a Unix domain socket:
+
+    HISTORY <repository>\t<commit>\t<path>
+        -> MISS, daemon starts resolving and later requests get
+        -> HISTORY <count> followed by count lines
+           <commit> <descendant> <blob>
+    BLOB <repository>\t<blob>
+        -> FD <size>, descriptor of shared memory segment holding the
+        blob is passed along the answer with SCM_RIGHTS
+
+Requests for repositories the user of the client can't read, and failed
+requests, answer ERROR. Without a running daemon, or after any
+error, calls fail and qdiff does all the work in process.
+*/
+
+// History of a file resolved by the daemon, commits[0] is the start commit,
+// descendants[i] is index of commit which commit i was found from and
+// blobs[i] is blob of the file in commit i
+typedef struct
+{
+    git_oid *commits;
+    git_oid *blobs;
+    long *descendants;
+    size_t count;
+} cache_history_t;
+
+void cache_socket_path(char *out, size_t size);
+int cache_client_connect(void);
+void cache_client_disconnect(void);
+int cache_client_history(git_repository *repo, const git_oid *commit, const char *path, cache_history_t *history);
+void cache_history_free(cache_history_t *history);
+int cache_client_blob(git_repository *repo, const git_oid *oid, void **mapping, size_t *size);
+void cache_client_release(void *mapping, size_t size);
+
+#endif
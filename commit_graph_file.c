@@ -0,0 +1,392 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "commit_graph_file.h"
+
+#define GRAPH_SIGNATURE "CGPH"
+#define GRAPH_HEADER_SIZE 8
+#define GRAPH_CHUNK_ENTRY_SIZE 12
+#define GRAPH_HASH_SIZE 20
+#define GRAPH_DATA_SIZE (GRAPH_HASH_SIZE + 16)
+#define GRAPH_PARENT_NONE 0x70000000
+#define GRAPH_EXTRA_EDGES 0x80000000
+#define GRAPH_LAST_EDGE 0x80000000
+#define BLOOM_HEADER_SIZE 12
+
+#define CHUNK_OID_FANOUT 0x4f494446   // "OIDF"
+#define CHUNK_OID_LOOKUP 0x4f49444c   // "OIDL"
+#define CHUNK_COMMIT_DATA 0x43444154  // "CDAT"
+#define CHUNK_EXTRA_EDGES 0x45444745  // "EDGE"
+#define CHUNK_BLOOM_INDEX 0x42494458  // "BIDX"
+#define CHUNK_BLOOM_DATA 0x42444154   // "BDAT"
+
+static uint32_t get_be32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint64_t get_be64(const unsigned char *p)
+{
+    return (uint64_t)get_be32(p) << 32 | get_be32(p + 4);
+}
+
+// Check parent positions of every commit, octopus merge edge lists must
+// stay inside EDGE chunk and end with last edge mark
+static int commit_graph_file_parents_valid(const commit_graph_file_t *graph)
+{
+    for (uint32_t i = 0; i < graph->commits_count; i++)
+    {
+        const unsigned char *commit = graph->commit_data + (size_t)i * GRAPH_DATA_SIZE;
+        uint32_t parent1 = get_be32(commit + GRAPH_HASH_SIZE);
+        uint32_t parent2 = get_be32(commit + GRAPH_HASH_SIZE + 4);
+        if (parent1 != GRAPH_PARENT_NONE && parent1 >= graph->commits_count)
+        {
+            return 0;
+        }
+        if (parent2 == GRAPH_PARENT_NONE)
+        {
+            continue;
+        }
+        if (!(parent2 & GRAPH_EXTRA_EDGES))
+        {
+            if (parent2 >= graph->commits_count)
+            {
+                return 0;
+            }
+            continue;
+        }
+        uint32_t edge = parent2 & ~GRAPH_EXTRA_EDGES;
+        uint32_t value = 0;
+        do
+        {
+            if (edge >= graph->extra_edges_count)
+            {
+                return 0;
+            }
+            value = get_be32(graph->extra_edges + (size_t)edge++ * 4);
+            if ((value & ~GRAPH_LAST_EDGE) >= graph->commits_count)
+            {
+                return 0;
+            }
+        } while (!(value & GRAPH_LAST_EDGE));
+    }
+    return 1;
+}
+
+// Map commit-graph of repository, returns NULL if there is none or it can't be used
+commit_graph_file_t *commit_graph_file_open(git_repository *repo)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%sobjects/info/commit-graph", git_repository_commondir(repo));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < GRAPH_HEADER_SIZE + GRAPH_CHUNK_ENTRY_SIZE)
+    {
+        close(fd);
+        return NULL;
+    }
+    unsigned char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    commit_graph_file_t *graph = calloc(1, sizeof(commit_graph_file_t));
+    if (!graph)
+    {
+        munmap(data, st.st_size);
+        return NULL;
+    }
+    graph->data = data;
+    graph->size = st.st_size;
+
+    // header: signature, version 1, hash version 1 (SHA-1), chunk count, base graph count
+    if (memcmp(data, GRAPH_SIGNATURE, 4) != 0 || data[4] != 1 || data[5] != 1 || data[7] != 0)
+    {
+        commit_graph_file_free(graph);
+        return NULL;
+    }
+    size_t chunks_count = data[6];
+    if (GRAPH_HEADER_SIZE + (chunks_count + 1) * GRAPH_CHUNK_ENTRY_SIZE > graph->size)
+    {
+        commit_graph_file_free(graph);
+        return NULL;
+    }
+
+    // chunk table, each chunk ends where the next one starts
+    const unsigned char *bloom_data = NULL;
+    size_t bloom_data_size = 0;
+    uint64_t commit_data_size = 0;
+    uint64_t bloom_index_size = 0;
+    for (size_t i = 0; i < chunks_count; i++)
+    {
+        const unsigned char *entry = data + GRAPH_HEADER_SIZE + i * GRAPH_CHUNK_ENTRY_SIZE;
+        uint32_t id = get_be32(entry);
+        uint64_t offset = get_be64(entry + 4);
+        uint64_t end = get_be64(entry + GRAPH_CHUNK_ENTRY_SIZE + 4);
+        if (offset > end || end > graph->size)
+        {
+            commit_graph_file_free(graph);
+            return NULL;
+        }
+        switch (id)
+        {
+        case CHUNK_OID_FANOUT:
+            if (end - offset == 256 * 4)
+            {
+                graph->fanout = data + offset;
+            }
+            break;
+        case CHUNK_OID_LOOKUP:
+            graph->oids = data + offset;
+            graph->commits_count = (end - offset) / GRAPH_HASH_SIZE;
+            break;
+        case CHUNK_COMMIT_DATA:
+            graph->commit_data = data + offset;
+            commit_data_size = end - offset;
+            break;
+        case CHUNK_EXTRA_EDGES:
+            graph->extra_edges = data + offset;
+            graph->extra_edges_count = (end - offset) / 4;
+            break;
+        case CHUNK_BLOOM_INDEX:
+            graph->bloom_index = data + offset;
+            bloom_index_size = end - offset;
+            break;
+        case CHUNK_BLOOM_DATA:
+            bloom_data = data + offset;
+            bloom_data_size = end - offset;
+            break;
+        }
+    }
+    if (!graph->fanout || !graph->oids || !graph->commit_data ||
+        get_be32(graph->fanout + 255 * 4) != graph->commits_count ||
+        commit_data_size != (uint64_t)graph->commits_count * GRAPH_DATA_SIZE ||
+        (graph->bloom_index && bloom_index_size != (uint64_t)graph->commits_count * 4))
+    {
+        commit_graph_file_free(graph);
+        return NULL;
+    }
+    // fanout counts bound oid lookups, they may never decrease
+    for (int i = 1; i < 256; i++)
+    {
+        if (get_be32(graph->fanout + (i - 1) * 4) > get_be32(graph->fanout + i * 4))
+        {
+            commit_graph_file_free(graph);
+            return NULL;
+        }
+    }
+    // missing EDGE chunk is caught here as well, its count is then 0
+    if (!commit_graph_file_parents_valid(graph))
+    {
+        commit_graph_file_free(graph);
+        return NULL;
+    }
+
+    // filters are used only when both chunks are present and readable
+    if (graph->bloom_index && bloom_data && bloom_data_size >= BLOOM_HEADER_SIZE)
+    {
+        graph->bloom_version = get_be32(bloom_data);
+        graph->bloom_hashes = get_be32(bloom_data + 4);
+        graph->bloom_data = bloom_data + BLOOM_HEADER_SIZE;
+        graph->bloom_data_size = bloom_data_size - BLOOM_HEADER_SIZE;
+    }
+    if (!graph->bloom_data || (graph->bloom_version != 1 && graph->bloom_version != 2) || graph->bloom_hashes == 0)
+    {
+        graph->bloom_index = NULL;
+        graph->bloom_data = NULL;
+    }
+    return graph;
+}
+
+void commit_graph_file_free(commit_graph_file_t *graph)
+{
+    if (!graph)
+    {
+        return;
+    }
+    munmap(graph->data, graph->size);
+    free(graph);
+}
+
+// Position of commit in graph, GRAPH_NO_POSITION if it is not there
+uint32_t commit_graph_file_find(const commit_graph_file_t *graph, const git_oid *oid)
+{
+    if (!graph)
+    {
+        return GRAPH_NO_POSITION;
+    }
+    uint32_t low = oid->id[0] ? get_be32(graph->fanout + (oid->id[0] - 1) * 4) : 0;
+    uint32_t high = get_be32(graph->fanout + oid->id[0] * 4);
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        int compare = memcmp(graph->oids + (size_t)middle * GRAPH_HASH_SIZE, oid->id, GRAPH_HASH_SIZE);
+        if (compare == 0)
+        {
+            return middle;
+        }
+        if (compare < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return GRAPH_NO_POSITION;
+}
+
+void commit_graph_file_oid(const commit_graph_file_t *graph, uint32_t position, git_oid *out)
+{
+    git_oid_fromraw(out, graph->oids + (size_t)position * GRAPH_HASH_SIZE);
+}
+
+// Oid of commit root tree
+void commit_graph_file_tree(const commit_graph_file_t *graph, uint32_t position, git_oid *out)
+{
+    git_oid_fromraw(out, graph->commit_data + (size_t)position * GRAPH_DATA_SIZE);
+}
+
+size_t commit_graph_file_parent_count(const commit_graph_file_t *graph, uint32_t position)
+{
+    const unsigned char *commit = graph->commit_data + (size_t)position * GRAPH_DATA_SIZE;
+    uint32_t parent1 = get_be32(commit + GRAPH_HASH_SIZE);
+    uint32_t parent2 = get_be32(commit + GRAPH_HASH_SIZE + 4);
+    if (parent1 == GRAPH_PARENT_NONE)
+    {
+        return 0;
+    }
+    if (parent2 == GRAPH_PARENT_NONE)
+    {
+        return 1;
+    }
+    if (!(parent2 & GRAPH_EXTRA_EDGES))
+    {
+        return 2;
+    }
+    // octopus merge, parents after the first one are in extra edges list
+    size_t count = 1;
+    // edge lists were checked to end inside the chunk when graph was opened
+    const unsigned char *edge = graph->extra_edges + (size_t)(parent2 & ~GRAPH_EXTRA_EDGES) * 4;
+    while (1)
+    {
+        count++;
+        if (get_be32(edge) & GRAPH_LAST_EDGE)
+        {
+            break;
+        }
+        edge += 4;
+    }
+    return count;
+}
+
+// Graph position of n-th parent
+uint32_t commit_graph_file_parent(const commit_graph_file_t *graph, uint32_t position, size_t n)
+{
+    const unsigned char *commit = graph->commit_data + (size_t)position * GRAPH_DATA_SIZE;
+    if (n == 0)
+    {
+        return get_be32(commit + GRAPH_HASH_SIZE);
+    }
+    uint32_t parent2 = get_be32(commit + GRAPH_HASH_SIZE + 4);
+    if (!(parent2 & GRAPH_EXTRA_EDGES))
+    {
+        return parent2;
+    }
+    return get_be32(graph->extra_edges + (size_t)((parent2 & ~GRAPH_EXTRA_EDGES) + n - 1) * 4) & ~GRAPH_LAST_EDGE;
+}
+
+static uint32_t rotate_left(uint32_t value, int count)
+{
+    return (value << count) | (value >> (32 - count));
+}
+
+// Murmur3 hash as git computes it for Bloom filter keys. Version 1 filters
+// were written with bytes read as signed chars, which matters for non-ASCII paths.
+static uint32_t murmur3(uint32_t seed, const char *data, size_t length, int signed_bytes)
+{
+    const uint32_t c1 = 0xcc9e2d51;
+    const uint32_t c2 = 0x1b873593;
+    uint32_t hash = seed;
+    size_t i = 0;
+    uint32_t bytes[4];
+    for (; i + 4 <= length; i += 4)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            bytes[j] = signed_bytes ? (uint32_t)(signed char)data[i + j] : (uint32_t)(unsigned char)data[i + j];
+        }
+        uint32_t k = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | bytes[3] << 24;
+        k *= c1;
+        k = rotate_left(k, 15);
+        k *= c2;
+        hash ^= k;
+        hash = rotate_left(hash, 13);
+        hash = hash * 5 + 0xe6546b64;
+    }
+    uint32_t k = 0;
+    for (size_t j = length - i; j > 0; j--)
+    {
+        uint32_t byte = signed_bytes ? (uint32_t)(signed char)data[i + j - 1] : (uint32_t)(unsigned char)data[i + j - 1];
+        k ^= byte << (8 * (j - 1));
+    }
+    if (length - i > 0)
+    {
+        k *= c1;
+        k = rotate_left(k, 15);
+        k *= c2;
+        hash ^= k;
+    }
+    hash ^= length;
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+/*
+Check changed-path Bloom filter of commit. Filter describes paths changed
+between commit and its first parent. Returns 0 only if path was certainly
+not changed, 1 if it might have been or there is no filter for the commit.
+*/
+int commit_graph_file_maybe_changed(const commit_graph_file_t *graph, uint32_t position, const char *path)
+{
+    if (!graph || !graph->bloom_index || position >= graph->commits_count)
+    {
+        return 1;
+    }
+    uint32_t start = position ? get_be32(graph->bloom_index + (size_t)(position - 1) * 4) : 0;
+    uint32_t end = get_be32(graph->bloom_index + (size_t)position * 4);
+    if (end <= start || end > graph->bloom_data_size)
+    {
+        return 1;
+    }
+    const unsigned char *filter = graph->bloom_data + start;
+    uint64_t bits = (uint64_t)(end - start) * 8;
+    size_t length = strlen(path);
+    int signed_bytes = graph->bloom_version == 1;
+    uint32_t hash0 = murmur3(0x293ae76f, path, length, signed_bytes);
+    uint32_t hash1 = murmur3(0x7e646e2c, path, length, signed_bytes);
+    for (uint32_t i = 0; i < graph->bloom_hashes; i++)
+    {
+        uint64_t bit = (uint32_t)(hash0 + i * hash1) % bits;
+        if (!(filter[bit / 8] & (1 << (bit % 8))))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
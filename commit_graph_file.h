@@ -0,0 +1,45 @@
+#ifndef COMMIT_GRAPH_FILE_H
+#define COMMIT_GRAPH_FILE_H
+
+#include <stdint.h>
+#include <git2.h>
+
+/*
+Reader for git's commit-graph file (objects/info/commit-graph).
+It stores parents, root tree and generation of every commit in it and
+optionally changed-path Bloom filters, so history can be walked without
+inflating commit objects. Only single file graphs with SHA-1 are read,
+split graph chains are treated as missing. Chunk sizes and parent
+positions are checked when the file is opened, a file failing any check
+is treated as missing too.
+*/
+
+#define GRAPH_NO_POSITION 0xffffffff
+
+typedef struct
+{
+    unsigned char *data;             // mapped file
+    size_t size;                     // size of mapped file
+    uint32_t commits_count;          // number of commits in graph
+    const unsigned char *fanout;     // OIDF chunk, 256 cumulative counts by first oid byte
+    const unsigned char *oids;       // OIDL chunk, sorted commit oids
+    const unsigned char *commit_data; // CDAT chunk, tree, parents, generation and time of each commit
+    const unsigned char *extra_edges; // EDGE chunk, parents of octopus merges, NULL if none
+    uint32_t extra_edges_count;       // 4 byte entries in EDGE chunk
+    const unsigned char *bloom_index; // BIDX chunk, end offsets of filters, NULL if no filters
+    const unsigned char *bloom_data;  // BDAT chunk data after its header
+    size_t bloom_data_size;
+    uint32_t bloom_version;          // 1 or 2, version 1 hashes paths as signed chars
+    uint32_t bloom_hashes;           // number of hash functions
+} commit_graph_file_t;
+
+commit_graph_file_t *commit_graph_file_open(git_repository *repo);
+void commit_graph_file_free(commit_graph_file_t *graph);
+uint32_t commit_graph_file_find(const commit_graph_file_t *graph, const git_oid *oid);
+void commit_graph_file_oid(const commit_graph_file_t *graph, uint32_t position, git_oid *out);
+void commit_graph_file_tree(const commit_graph_file_t *graph, uint32_t position, git_oid *out);
+size_t commit_graph_file_parent_count(const commit_graph_file_t *graph, uint32_t position);
+uint32_t commit_graph_file_parent(const commit_graph_file_t *graph, uint32_t position, size_t n);
+int commit_graph_file_maybe_changed(const commit_graph_file_t *graph, uint32_t position, const char *path);
+
+#endif
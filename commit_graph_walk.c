@@ -2,7 +2,16 @@
 #include <git2.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <string.h>
 #include "commit_graph_walk.h"
+#include "timer.h"
+#include "cache_client.h"
+#include "stats.h"
+
+// Search frontier is prefetched every PREFETCH_INTERVAL pushed commits,
+// looking PREFETCH_DEPTH commits ahead along first parents
+#define PREFETCH_INTERVAL 16
+#define PREFETCH_DEPTH 64
 
 commit_graph_node_t *commit_graph_node_init(void)
 {
@@ -11,12 +20,22 @@ commit_graph_node_t *commit_graph_node_init(void)
     {
         return NULL;
     }
+    node->kind = NODE_COMMIT;
     node->commit = NULL;
     node->entry = NULL;
     node->descendant = NULL;
     node->ancestors = NULL;
     node->ancestor_count = 0;
     node->ancestors_fetched = 0;
+    node->search = NULL;
+    node->graph_file = NULL;
+    node->prefetcher = NULL;
+    node->versions = NULL;
+    memset(&node->blob_id, 0, sizeof(git_oid));
+    node->content = NULL;
+    node->content_size = 0;
+    node->path = NULL;
+    stats.nodes++;
     return node;
 }
 
@@ -26,6 +45,29 @@ commit_graph_walk_t *commit_graph_walk_init(git_commit *start_commit, const char
     {
         return NULL;
     }
+    git_repository *repo = git_commit_owner(start_commit);
+    commit_graph_file_t *graph_file = commit_graph_file_open(repo);
+    prefetcher_t *prefetcher = prefetcher_init(repo);
+    commit_graph_walk_t *walk = commit_graph_walk_init_shared(start_commit, _filename, graph_file, prefetcher);
+    if (!walk)
+    {
+        prefetcher_free(prefetcher);
+        commit_graph_file_free(graph_file);
+        return NULL;
+    }
+    walk->shared_files = 0;
+    return walk;
+}
+
+// Walk using commit-graph file and prefetcher of the caller, which has to
+// keep them until the walk is freed. Lets the cache daemon open them once
+// per repository for all histories it resolves.
+commit_graph_walk_t *commit_graph_walk_init_shared(git_commit *start_commit, const char *filename, commit_graph_file_t *graph_file, prefetcher_t *prefetcher)
+{
+    if (!filename)
+    {
+        return NULL;
+    }
     commit_graph_walk_t *walk = malloc(sizeof(commit_graph_walk_t));
     if (!walk)
     {
@@ -40,11 +82,21 @@ commit_graph_walk_t *commit_graph_walk_init(git_commit *start_commit, const char
 
     git_tree *commit_tree = NULL;
     git_commit_tree(&commit_tree, start_commit);
-    const git_tree_entry *tmp_entry = git_tree_entry_byname(commit_tree, _filename);
+    const git_tree_entry *tmp_entry = git_tree_entry_byname(commit_tree, filename);
     git_tree_entry_dup(&(root->entry), tmp_entry);
     git_tree_free(commit_tree);
     git_commit_dup(&(root->commit), start_commit);
-    commit_graph_fetch_ancestors(root);
+    stats.node_commits++;
+    walk->graph_file = graph_file;
+    root->graph_file = walk->graph_file;
+    walk->prefetcher = prefetcher;
+    root->prefetcher = walk->prefetcher;
+    walk->shared_files = 1;
+    walk->versions = version_index_init();
+    root->versions = walk->versions;
+    version_index_add(walk->versions, root);
+    // ancestors are not fetched here so the starting commit can be shown
+    // right away, they are searched later with commit_graph_fetch_ancestors_step
     walk->current = root;
     return walk;
 }
@@ -61,8 +113,14 @@ void commit_graph_node_free(commit_graph_node_t *node)
         commit_graph_node_free(node->ancestors[i]);
     }
     free(node->ancestors);
+    ancestor_search_free(node->search);
+    stats.nodes--;
+    stats.node_commits -= node->commit != NULL;
+    stats.virtual_bytes -= node->content ? node->content_size : 0;
     git_commit_free(node->commit);
     git_tree_entry_free(node->entry);
+    free(node->content);
+    free(node->path);
     free(node);
 }
 
@@ -78,38 +136,303 @@ void commit_graph_walk_free(commit_graph_walk_t *walk)
         walk->current = walk->current->descendant;
     }
     commit_graph_node_free(walk->current);
+    if (!walk->shared_files)
+    {
+        prefetcher_free(walk->prefetcher);
+        commit_graph_file_free(walk->graph_file);
+    }
+    version_index_free(walk->versions);
     free(walk);
 }
 
+// Blocking version of ancestor search, runs until all ancestors are found
 int commit_graph_fetch_ancestors(commit_graph_node_t *node)
+{
+    return commit_graph_fetch_ancestors_step(node, 0, 0);
+}
+
+// Check if tree has the same entry as the searched one
+static int tree_has_entry(commit_graph_node_t *node, const git_oid *tree_id, const git_tree_entry *entry)
+{
+    git_repository *repo = git_commit_owner(node->commit);
+    prefetcher_note_read(node->prefetcher, tree_id);
+    git_tree *tree;
+    if (git_tree_lookup(&tree, repo, tree_id) != 0)
+    {
+        return 0;
+    }
+    const git_tree_entry *current_entry = git_tree_entry_byname(tree, git_tree_entry_name(entry));
+    int same = current_entry && git_oid_equal(git_tree_entry_id(current_entry), git_tree_entry_id(entry));
+    git_tree_free(tree);
+    return same;
+}
+
+// Check if commit has the searched entry and if so put it on the search stack.
+// Commits found in commit-graph file are not loaded, their tree oid and
+// parents come from the file. known_match skips the check when it is
+// already known commit has the entry. Returns 1 if commit was pushed.
+static int search_push(ancestor_search_t *search, commit_graph_node_t *node, const git_oid *oid, uint32_t position, int known_match)
+{
+    if (visited_set_contains(search->visited, oid))
+    {
+        return 0;
+    }
+    search->commits_searched++;
+
+    git_repository *repo = git_commit_owner(node->commit);
+    git_commit *commit = NULL;
+    if (position == GRAPH_NO_POSITION)
+    {
+        prefetcher_note_read(node->prefetcher, oid);
+        if (git_commit_lookup(&commit, repo, oid) != 0)
+        {
+            return 0;
+        }
+    }
+    if (!known_match)
+    {
+        git_oid tree_id;
+        if (commit)
+        {
+            git_oid_cpy(&tree_id, git_commit_tree_id(commit));
+        }
+        else
+        {
+            commit_graph_file_tree(node->graph_file, position, &tree_id);
+        }
+        if (!tree_has_entry(node, &tree_id, search->entry))
+        {
+            git_commit_free(commit);
+            return 0;
+        }
+    }
+
+    visited_set_add(search->visited, oid);
+    if (search->stack_size == search->stack_capacity)
+    {
+        search->stack_capacity *= 2;
+        search->stack = realloc(search->stack, search->stack_capacity * sizeof(search_frame_t));
+        if (!search->stack)
+        {
+            perror("Failed to reallocate memory for search stack");
+            exit(EXIT_FAILURE);
+        }
+    }
+    search_frame_t *frame = &search->stack[search->stack_size++];
+    git_oid_cpy(&frame->oid, oid);
+    frame->position = position;
+    frame->commit = commit;
+    stats.search_commits += commit != NULL;
+    frame->next_parent = 0;
+    frame->found = 0;
+    search->prefetch_due++;
+    return 1;
+}
+
+/*
+Ask prefetcher for objects search will read next. In commit-graph these
+are trees of first parents along the top commit whose Bloom filter does not
+rule out the file, plus trees of its other parents. Without commit-graph
+only parent commits of the top commit are known ahead.
+*/
+static void search_prefetch(ancestor_search_t *search, commit_graph_node_t *node, const char *path)
+{
+    search->prefetch_due = 0;
+    if (!node->prefetcher || search->stack_size == 0)
+    {
+        return;
+    }
+    search_frame_t *top = &search->stack[search->stack_size - 1];
+    if (top->commit)
+    {
+        for (size_t i = 0; i < git_commit_parentcount(top->commit); i++)
+        {
+            prefetcher_request(node->prefetcher, git_commit_parent_id(top->commit, i));
+        }
+        return;
+    }
+    git_oid tree_id;
+    for (size_t i = 1; i < commit_graph_file_parent_count(node->graph_file, top->position); i++)
+    {
+        commit_graph_file_tree(node->graph_file, commit_graph_file_parent(node->graph_file, top->position, i), &tree_id);
+        prefetcher_request(node->prefetcher, &tree_id);
+    }
+    uint32_t position = top->position;
+    for (int depth = 0; depth < PREFETCH_DEPTH && commit_graph_file_parent_count(node->graph_file, position) > 0; depth++)
+    {
+        uint32_t parent = commit_graph_file_parent(node->graph_file, position, 0);
+        if (commit_graph_file_maybe_changed(node->graph_file, position, path))
+        {
+            commit_graph_file_tree(node->graph_file, parent, &tree_id);
+            prefetcher_request(node->prefetcher, &tree_id);
+        }
+        position = parent;
+    }
+}
+
+static size_t frame_parent_count(const commit_graph_node_t *node, const search_frame_t *frame)
+{
+    if (frame->commit)
+    {
+        return git_commit_parentcount(frame->commit);
+    }
+    return commit_graph_file_parent_count(node->graph_file, frame->position);
+}
+
+// Get oid and commit-graph position of n-th parent of frame commit
+static void frame_parent(const commit_graph_node_t *node, const search_frame_t *frame, size_t n, git_oid *oid, uint32_t *position)
+{
+    if (frame->commit)
+    {
+        git_oid_cpy(oid, git_commit_parent_id(frame->commit, n));
+        *position = commit_graph_file_find(node->graph_file, oid);
+        return;
+    }
+    *position = commit_graph_file_parent(node->graph_file, frame->position, n);
+    commit_graph_file_oid(node->graph_file, *position, oid);
+}
+
+/*
+Depth first search for the oldest commits that still have the same
+entry as the node parents. Instead of recursion it keeps its own stack
+in node->search so it can stop after checking commit_budget commits or
+after time_budget_ms and continue from the same place on next call.
+Budget of 0 means no limit.
+
+When repository has commit-graph file, commits in it are walked without
+loading them and first parents whose changed-path Bloom filter rules out
+the file are accepted without loading their tree.
+*/
+int commit_graph_fetch_ancestors_step(commit_graph_node_t *node, size_t commit_budget, double time_budget_ms)
 {
     if (node->ancestors_fetched)
     {
-        return 1;
+        return FETCH_ALREADY_DONE;
     }
-    if (node->ancestor_count != 0 || node->ancestors)
+    if (!node->search)
     {
-        return -1;
+        if (node->ancestor_count != 0 || node->ancestors)
+        {
+            return FETCH_ERROR;
+        }
+        node->search = ancestor_search_init();
     }
-    // Initialize visited set
-    visited_set_t *visited = visited_set_init();
+    ancestor_search_t *search = node->search;
+    git_repository *repo = git_commit_owner(node->commit);
+    const char *path = commit_graph_node_name(node);
+    size_t budget_end = search->commits_searched + commit_budget;
+    double start = timer_now_ms();
+    double deadline = start + time_budget_ms;
+    stats.search_slices++;
 
-    // check all parents (node children) with recursive function
-    git_tree *tree;
-    const git_tree_entry *entry;
-    size_t parent_count = git_commit_parentcount(node->commit);
-    git_commit *parent = NULL;
-    for (size_t i = 0; i < parent_count; i++)
+    while (1)
     {
-        git_commit_parent(&parent, node->commit, i); // freed in recursive function if wont be used
-        git_commit_tree(&tree, parent);
-        entry = git_tree_entry_byname(tree, git_tree_entry_name(node->entry));
-        search_git_tree_for_oldest_with_entry(parent, node, visited, entry);
+        if ((commit_budget && search->commits_searched >= budget_end) ||
+            (time_budget_ms > 0 && timer_now_ms() >= deadline))
+        {
+            stats.search_ms += timer_now_ms() - start;
+            return FETCH_IN_PROGRESS;
+        }
+
+        // start search from next parent of node commit
+        if (search->stack_size == 0)
+        {
+            git_tree_entry_free(search->entry);
+            search->entry = NULL;
+            if (search->next_root >= git_commit_parentcount(node->commit))
+            {
+                break;
+            }
+            const git_oid *parent_id = git_commit_parent_id(node->commit, search->next_root++);
+            git_commit *parent = NULL;
+            git_tree *tree = NULL;
+            const git_tree_entry *entry = NULL;
+            if (git_commit_lookup(&parent, repo, parent_id) == 0 && git_commit_tree(&tree, parent) == 0)
+            {
+                entry = git_tree_entry_byname(tree, path);
+            }
+            git_commit_free(parent);
+            // file was added in node commit, nothing to find through this parent
+            if (!entry)
+            {
+                git_tree_free(tree);
+                continue;
+            }
+            git_tree_entry_dup(&search->entry, entry);
+            git_tree_free(tree);
+            search_push(search, node, parent_id, commit_graph_file_find(node->graph_file, parent_id), 1);
+            continue;
+        }
+
+        if (search->prefetch_due >= PREFETCH_INTERVAL)
+        {
+            search_prefetch(search, node, path);
+        }
+
+        // go deeper through next unchecked parent
+        search_frame_t *frame = &search->stack[search->stack_size - 1];
+        if (frame->next_parent < frame_parent_count(node, frame))
+        {
+            size_t n = frame->next_parent++;
+            git_oid parent_id;
+            uint32_t parent_position;
+            frame_parent(node, frame, n, &parent_id, &parent_position);
+            // Bloom filters describe changes against first parent only
+            int unchanged = n == 0 && frame->position != GRAPH_NO_POSITION &&
+                            !commit_graph_file_maybe_changed(node->graph_file, frame->position, path);
+            search_push(search, node, &parent_id, parent_position, unchanged);
+            continue;
+        }
+
+        // all parents checked, if no older commits found this is the oldest one
+        search->stack_size--;
+        int found = frame->found;
+        git_commit *commit = frame->commit;
+        stats.search_commits -= commit != NULL;
+        if (found == 0 && (commit || git_commit_lookup(&commit, repo, &frame->oid) == 0))
+        {
+            add_ancestor(node, commit, search->entry);
+            found = 1;
+        }
+        else
+        {
+            git_commit_free(commit);
+        }
+        if (search->stack_size > 0)
+        {
+            search->stack[search->stack_size - 1].found += found;
+        }
     }
+
     // Mark as fetched and clean up
     node->ancestors_fetched = 1;
-    visited_set_free(visited);
-    return 0;
+    ancestor_search_free(search);
+    node->search = NULL;
+    stats.search_ms += timer_now_ms() - start;
+    return FETCH_DONE;
+}
+
+// Stop unfinished search, work done so far is kept in node
+void commit_graph_search_pause(commit_graph_node_t *node)
+{
+    if (node && node->search)
+    {
+        node->search->paused = 1;
+    }
+}
+
+void commit_graph_search_resume(commit_graph_node_t *node)
+{
+    if (node && node->search)
+    {
+        node->search->paused = 0;
+    }
+}
+
+// Check if node still needs searching and user did not stop it
+int commit_graph_search_active(commit_graph_node_t *node)
+{
+    return node && !node->ancestors_fetched && !(node->search && node->search->paused);
 }
 
 // void search_git_tree_for_changed_file(git_commit *commit, commit_graph_node_t *search_root, visited_set_t *visited, git_tree_entry *entry)
@@ -152,98 +475,565 @@ int commit_graph_fetch_ancestors(commit_graph_node_t *node)
 //     return;
 // }
 
-int search_git_tree_for_oldest_with_entry(git_commit *commit, commit_graph_node_t *for_result, visited_set_t *visited, const git_tree_entry *entry)
+// Append new node for commit to ancestors of node, it is not yet indexed
+static commit_graph_node_t *append_ancestor(commit_graph_node_t *node, git_commit *commit)
 {
-    // Check for null or already visited commit
-    if (!commit || visited_set_contains(visited, git_commit_id(commit)))
+    node->ancestor_count++;
+    node->ancestors = realloc(node->ancestors, node->ancestor_count * sizeof(commit_graph_node_t *));
+    commit_graph_node_t *ancestor = commit_graph_node_init();
+    node->ancestors[node->ancestor_count - 1] = ancestor;
+    ancestor->commit = commit;
+    stats.node_commits++;
+    ancestor->descendant = node;
+    ancestor->graph_file = node->graph_file;
+    ancestor->prefetcher = node->prefetcher;
+    ancestor->versions = node->versions;
+    return ancestor;
+}
+
+void add_ancestor(commit_graph_node_t *node, git_commit *commit, const git_tree_entry *entry)
+{
+    if (!node || !commit || !entry)
     {
-        if (commit) git_commit_free(commit);
-        return 0;
+        return;
     }
+    commit_graph_node_t *ancestor = append_ancestor(node, commit);
+    git_tree_entry_dup(&(ancestor->entry), entry);
+    version_index_add(node->versions, ancestor);
+}
 
-    // Get the tree for this commit
-    git_tree *tree;
-    if (git_commit_tree(&tree, commit) != 0)
+int commit_graph_walk_to_ancestor(commit_graph_walk_t *walk, int ancestor_index)
+{
+    if (!walk || !walk->current || ancestor_index < 0)
+    {
+        return 1;
+    }
+    if (ancestor_index >= walk->current->ancestor_count)
+    {
+        return 2;
+    }
+    walk->current = walk->current->ancestors[ancestor_index];
+    return 0;
+}
+
+int commit_graph_walk_to_descendant(commit_graph_walk_t *walk)
+{
+    if (!walk || !walk->current || !walk->current->descendant)
+    {
+        return 1;
+    }
+    walk->current = walk->current->descendant;
+    return 0;
+}
+
+// Put virtual node above top of graph, it has top as its only ancestor
+static void link_virtual_node(commit_graph_node_t *top, commit_graph_node_t *node)
+{
+    node->ancestors = malloc(sizeof(commit_graph_node_t *));
+    node->ancestors[0] = top;
+    node->ancestor_count = 1;
+    node->ancestors_fetched = 1;
+    node->graph_file = top->graph_file;
+    node->prefetcher = top->prefetcher;
+    node->versions = top->versions;
+    top->descendant = node;
+}
+
+// Read whole file, returns 0 on success
+static int read_file(const char *path, char **content, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        return -1;
+    }
+    size_t capacity = 4096;
+    size_t length = 0;
+    char *buffer = malloc(capacity);
+    size_t read;
+    while (buffer && (read = fread(buffer + length, 1, capacity - length, file)) > 0)
+    {
+        length += read;
+        if (length == capacity)
+        {
+            capacity *= 2;
+            char *bigger = realloc(buffer, capacity);
+            if (!bigger)
+            {
+                free(buffer);
+            }
+            buffer = bigger;
+        }
+    }
+    int failed = !buffer || ferror(file);
+    fclose(file);
+    if (failed)
+    {
+        free(buffer);
+        return -1;
+    }
+    *content = buffer;
+    *size = length;
+    return 0;
+}
+
+// Put working tree version of walked file above HEAD root of the walk, and
+// index version between them when it differs from HEAD. Walk is moved to
+// the working tree node which is returned, NULL on failure.
+commit_graph_node_t *commit_graph_walk_add_worktree(commit_graph_walk_t *walk, const char *path)
+{
+    if (!walk || !walk->current || !walk->current->commit || !path)
+    {
+        return NULL;
+    }
+    commit_graph_node_t *top = walk->current;
+    git_repository *repo = git_commit_owner(top->commit);
+    const char *filename = git_tree_entry_name(top->entry);
+
+    git_index *index = NULL;
+    if (git_repository_index(&index, repo) == 0)
+    {
+        const git_index_entry *index_entry = git_index_get_bypath(index, filename, 0);
+        git_blob *blob = NULL;
+        if (index_entry && !git_oid_equal(&index_entry->id, git_tree_entry_id(top->entry)) &&
+            git_blob_lookup(&blob, repo, &index_entry->id) == 0)
+        {
+            commit_graph_node_t *node = commit_graph_node_init();
+            node->kind = NODE_INDEX;
+            git_oid_cpy(&node->blob_id, &index_entry->id);
+            node->content_size = git_blob_rawsize(blob);
+            node->content = malloc(node->content_size ? node->content_size : 1);
+            memcpy(node->content, git_blob_rawcontent(blob), node->content_size);
+            stats.virtual_bytes += node->content_size;
+            node->path = strdup(filename);
+            link_virtual_node(top, node);
+            top = node;
+            git_blob_free(blob);
+        }
+        git_index_free(index);
+    }
+
+    commit_graph_node_t *node = commit_graph_node_init();
+    node->kind = NODE_WORKTREE;
+    node->path = strdup(path);
+    if (commit_graph_node_reload_worktree(node) < 0)
+    {
+        commit_graph_node_free(node);
+        return NULL;
+    }
+    link_virtual_node(top, node);
+    walk->current = node;
+    return node;
+}
+
+// Read working tree file again, returns 1 if its content changed,
+// 0 if not and -1 if it can't be read (old content is kept then)
+int commit_graph_node_reload_worktree(commit_graph_node_t *node)
+{
+    if (!node || node->kind != NODE_WORKTREE)
+    {
+        return -1;
+    }
+    char *content = NULL;
+    size_t size = 0;
+    git_oid blob_id;
+    if (read_file(node->path, &content, &size) != 0 || git_odb_hash(&blob_id, content, size, GIT_OBJECT_BLOB) != 0)
+    {
+        free(content);
+        return -1;
+    }
+    if (node->content && git_oid_equal(&blob_id, &node->blob_id))
     {
-        git_commit_free(commit);
+        free(content);
         return 0;
     }
+    stats.virtual_bytes += size - (node->content ? node->content_size : 0);
+    free(node->content);
+    node->content = content;
+    node->content_size = size;
+    git_oid_cpy(&node->blob_id, &blob_id);
+    return 1;
+}
 
-    // Check if demanded entry exists in this commit's tree
-    const git_tree_entry *current_entry = git_tree_entry_byname(tree, git_tree_entry_name(entry));
-    git_tree_free(tree);
-    if (!current_entry || !git_oid_equal(git_tree_entry_id(current_entry), git_tree_entry_id(entry)))
+// Get content of file version represented by node. Blobs of commit nodes
+// come from cache daemon when one runs and are looked up in process
+// otherwise, virtual nodes give content kept in node. Content has to be
+// released with commit_graph_content_release. Returns 0 on success.
+int commit_graph_node_content(commit_graph_node_t *node, node_content_t *content)
+{
+    content->data = NULL;
+    content->size = 0;
+    content->blob = NULL;
+    content->mapping = NULL;
+    if (node->kind != NODE_COMMIT)
+    {
+        content->data = node->content;
+        content->size = node->content_size;
+        return 0;
+    }
+    git_repository *repo = git_commit_owner(node->commit);
+    if (cache_client_blob(repo, commit_graph_node_blob_id(node), &content->mapping, &content->size) == 0)
     {
-        git_commit_free(commit);
+        content->data = content->mapping;
         return 0;
     }
+    if (git_blob_lookup(&content->blob, repo, commit_graph_node_blob_id(node)) != 0)
+    {
+        return -1;
+    }
+    content->data = git_blob_rawcontent(content->blob);
+    content->size = git_blob_rawsize(content->blob);
+    return 0;
+}
 
-    // Mark as visited
-    visited_set_add(visited, git_commit_id(commit));
+void commit_graph_content_release(node_content_t *content)
+{
+    git_blob_free(content->blob);
+    cache_client_release(content->mapping, content->size);
+    content->blob = NULL;
+    content->mapping = NULL;
+}
 
-    // Recurse into parents
-    int found = 0;
-    size_t parent_count = git_commit_parentcount(commit);
-    git_commit *parent_commit;
-    for (size_t i = 0; i < parent_count; i++)
+// Build graph below node from history resolved elsewhere, by cache daemon.
+// commits[0] is commit of node, descendants[i] is index of commit which
+// commit i was found from and blobs[i] is blob of the file in commit i, so
+// no trees are looked up. All commits are looked up before graph is
+// changed, so on failure node is left as it was. Returns 0 on success.
+int commit_graph_node_add_history(commit_graph_node_t *node, const git_oid *commits, const git_oid *blobs, const long *descendants, size_t count)
+{
+    if (!node || !node->commit || count == 0 || node->ancestor_count || node->search ||
+        !git_oid_equal(&commits[0], git_commit_id(node->commit)))
     {
-        if (git_commit_parent(&parent_commit, commit, i) == 0)
+        return -1;
+    }
+    git_repository *repo = git_commit_owner(node->commit);
+    git_commit **found = calloc(count, sizeof(git_commit *));
+    commit_graph_node_t **nodes = calloc(count, sizeof(commit_graph_node_t *));
+    int error = !found || !nodes;
+    for (size_t i = 1; i < count && !error; i++)
+    {
+        error = descendants[i] < 0 || (size_t)descendants[i] >= i ||
+                git_commit_lookup(&found[i], repo, &commits[i]) != 0;
+    }
+    if (!error)
+    {
+        nodes[0] = node;
+        for (size_t i = 1; i < count; i++)
         {
-            int result = search_git_tree_for_oldest_with_entry(parent_commit, for_result, visited, entry);
-            found += result;
+            nodes[i] = append_ancestor(nodes[descendants[i]], found[i]);
+            git_oid_cpy(&nodes[i]->blob_id, &blobs[i]);
+            found[i] = NULL;
         }
+        for (size_t i = 0; i < count; i++)
+        {
+            nodes[i]->ancestors_fetched = 1;
+        }
+        version_index_add_many(node->versions, nodes + 1, count - 1);
+    }
+    for (size_t i = 1; found && i < count; i++)
+    {
+        git_commit_free(found[i]);
     }
+    free(found);
+    free(nodes);
+    return error ? -1 : 0;
+}
 
-    // If no older commits found this is the oldes one
-    if (found == 0)
+// Node itself for commit nodes, HEAD node below for virtual ones
+commit_graph_node_t *commit_graph_node_commit(commit_graph_node_t *node)
+{
+    while (node && node->kind != NODE_COMMIT)
     {
-        add_ancestor(for_result, commit, current_entry);
-        return 1;
+        node = node->ancestors[0];
     }
+    return node;
+}
 
-    git_commit_free(commit);
-    return found;
+const git_oid *commit_graph_node_blob_id(const commit_graph_node_t *node)
+{
+    return node->entry ? git_tree_entry_id(node->entry) : &node->blob_id;
 }
 
-void add_ancestor(commit_graph_node_t *node, git_commit *commit, const git_tree_entry *entry)
+// File name without directories, used to pick syntax highlighting
+const char *commit_graph_node_name(const commit_graph_node_t *node)
 {
-    if (!node || !commit || !entry)
+    if (node->kind == NODE_COMMIT)
+    {
+        // nodes of history from cache daemon have no entry, the name is
+        // the same all the way down to the starting commit
+        while (!node->entry && node->descendant)
+        {
+            node = node->descendant;
+        }
+        return git_tree_entry_name(node->entry);
+    }
+    const char *slash = strrchr(node->path, '/');
+    return slash ? slash + 1 : node->path;
+}
+
+// Resolve ancestors needed to find version shown at given time, that is the
+// newest found version not newer than time. Every found version newer than
+// time gets its ancestors searched, oldest first, since with merges any of
+// their branches may hold a version closer to time. Returns
+// FETCH_IN_PROGRESS when budget ran out, otherwise FETCH_DONE with target
+// set, the oldest version if all are newer.
+int commit_graph_goto_step(version_index_t *versions, git_time_t time, size_t commit_budget, double time_budget_ms, commit_graph_node_t **target)
+{
+    if (!versions || versions->size == 0)
+    {
+        return FETCH_ERROR;
+    }
+    double deadline = timer_now_ms() + time_budget_ms;
+    while (1)
+    {
+        size_t count = version_index_count_until(versions, time);
+        size_t next = count;
+        while (next < versions->size && versions->by_time[next]->ancestors_fetched)
+        {
+            next++;
+        }
+        if (next < versions->size)
+        {
+            double time_left = deadline - timer_now_ms();
+            if (time_budget_ms > 0 && time_left <= 0)
+            {
+                return FETCH_IN_PROGRESS;
+            }
+            int result = commit_graph_fetch_ancestors_step(versions->by_time[next], commit_budget, time_budget_ms > 0 ? time_left : 0);
+            if (result == FETCH_IN_PROGRESS || result == FETCH_ERROR)
+            {
+                return result;
+            }
+            continue;
+        }
+        *target = versions->by_time[count > 0 ? count - 1 : 0];
+        return FETCH_DONE;
+    }
+}
+
+// Resolve ancestors until the version commit has is found, a version with
+// blob whose commit is commit or one of its ancestors. Commit dates don't
+// tell which branch holds it, so unfetched versions are searched newest
+// first until it shows up. Returns FETCH_IN_PROGRESS when budget ran out,
+// FETCH_DONE with target set, or FETCH_ERROR when the whole history has no
+// such version.
+int commit_graph_goto_commit_step(version_index_t *versions, git_commit *commit, const git_oid *blob, size_t commit_budget, double time_budget_ms, commit_graph_node_t **target)
+{
+    if (!versions || versions->size == 0)
+    {
+        return FETCH_ERROR;
+    }
+    git_repository *repo = git_commit_owner(commit);
+    double deadline = timer_now_ms() + time_budget_ms;
+    while (1)
+    {
+        commit_graph_node_t *unfetched = NULL;
+        for (size_t i = versions->size; i > 0; i--)
+        {
+            commit_graph_node_t *node = versions->by_time[i - 1];
+            if (git_oid_equal(commit_graph_node_blob_id(node), blob) &&
+                (git_oid_equal(git_commit_id(node->commit), git_commit_id(commit)) ||
+                 git_graph_descendant_of(repo, git_commit_id(commit), git_commit_id(node->commit)) == 1))
+            {
+                *target = node;
+                return FETCH_DONE;
+            }
+            if (!unfetched && !node->ancestors_fetched)
+            {
+                unfetched = node;
+            }
+        }
+        if (!unfetched)
+        {
+            return FETCH_ERROR;
+        }
+        double time_left = deadline - timer_now_ms();
+        if (time_budget_ms > 0 && time_left <= 0)
+        {
+            return FETCH_IN_PROGRESS;
+        }
+        int result = commit_graph_fetch_ancestors_step(unfetched, commit_budget, time_budget_ms > 0 ? time_left : 0);
+        if (result == FETCH_IN_PROGRESS || result == FETCH_ERROR)
+        {
+            return result;
+        }
+    }
+}
+
+// Initialize an empty version index
+version_index_t *version_index_init(void)
+{
+    version_index_t *versions = malloc(sizeof(version_index_t));
+    if (!versions)
+    {
+        return NULL;
+    }
+    versions->by_time = NULL;
+    versions->by_oid = NULL;
+    versions->size = 0;
+    versions->capacity = 0;
+    return versions;
+}
+
+void version_index_free(version_index_t *versions)
+{
+    if (!versions)
     {
         return;
     }
-    node->ancestor_count++;
-    node->ancestors = realloc(node->ancestors, node->ancestor_count * sizeof(commit_graph_node_t *));
-    node->ancestors[node->ancestor_count - 1] = commit_graph_node_init();
-    node->ancestors[node->ancestor_count - 1]->commit = commit;
-    git_tree_entry_dup(&(node->ancestors[node->ancestor_count - 1]->entry), entry);
-    node->ancestors[node->ancestor_count - 1]->descendant = node;
+    free(versions->by_time);
+    free(versions->by_oid);
+    free(versions);
 }
 
-int commit_graph_walk_to_ancestor(commit_graph_walk_t *walk, int ancestor_index)
+// Number of versions with commit time not after time, which is also the
+// position of the first newer version in by_time
+size_t version_index_count_until(const version_index_t *versions, git_time_t time)
 {
-    if (!walk || !walk->current || ancestor_index < 0)
+    size_t low = 0;
+    size_t high = versions->size;
+    while (low < high)
     {
-        return 1;
+        size_t middle = low + (high - low) / 2;
+        if (git_commit_time(versions->by_time[middle]->commit) <= time)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
     }
-    if (ancestor_index >= walk->current->ancestor_count)
+    return low;
+}
+
+// Position of first version with commit oid not lower than oid
+static size_t version_index_oid_position(const version_index_t *versions, const git_oid *oid)
+{
+    size_t low = 0;
+    size_t high = versions->size;
+    while (low < high)
     {
-        return 2;
+        size_t middle = low + (high - low) / 2;
+        if (git_oid_cmp(git_commit_id(versions->by_oid[middle]->commit), oid) < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
     }
-    walk->current = walk->current->ancestors[ancestor_index];
-    commit_graph_fetch_ancestors(walk->current);
-    return 0;
+    return low;
 }
 
-int commit_graph_walk_to_descendant(commit_graph_walk_t *walk)
+// Grow both orders to fit count more nodes, returns 0 on success
+static int version_index_reserve(version_index_t *versions, size_t count)
 {
-    if (!walk || !walk->current || !walk->current->descendant)
+    if (versions->size + count <= versions->capacity)
     {
-        return 1;
+        return 0;
     }
-    walk->current = walk->current->descendant;
+    size_t capacity = versions->capacity ? versions->capacity * 2 : 64;
+    while (capacity < versions->size + count)
+    {
+        capacity *= 2;
+    }
+    commit_graph_node_t **by_time = realloc(versions->by_time, capacity * sizeof(commit_graph_node_t *));
+    if (!by_time)
+    {
+        return -1;
+    }
+    versions->by_time = by_time;
+    commit_graph_node_t **by_oid = realloc(versions->by_oid, capacity * sizeof(commit_graph_node_t *));
+    if (!by_oid)
+    {
+        return -1;
+    }
+    versions->by_oid = by_oid;
+    versions->capacity = capacity;
     return 0;
 }
 
+// Insert commit node to both orders, virtual nodes are not indexed
+void version_index_add(version_index_t *versions, commit_graph_node_t *node)
+{
+    if (!versions || !node || !node->commit)
+    {
+        return;
+    }
+    if (version_index_reserve(versions, 1) != 0)
+    {
+        return;
+    }
+    size_t position = version_index_count_until(versions, git_commit_time(node->commit));
+    memmove(&versions->by_time[position + 1], &versions->by_time[position], (versions->size - position) * sizeof(commit_graph_node_t *));
+    versions->by_time[position] = node;
+    position = version_index_oid_position(versions, git_commit_id(node->commit));
+    memmove(&versions->by_oid[position + 1], &versions->by_oid[position], (versions->size - position) * sizeof(commit_graph_node_t *));
+    versions->by_oid[position] = node;
+    versions->size++;
+}
+
+static int compare_time(const void *a, const void *b)
+{
+    git_time_t time_a = git_commit_time((*(commit_graph_node_t *const *)a)->commit);
+    git_time_t time_b = git_commit_time((*(commit_graph_node_t *const *)b)->commit);
+    return (time_a > time_b) - (time_a < time_b);
+}
+
+static int compare_oid(const void *a, const void *b)
+{
+    return git_oid_cmp(git_commit_id((*(commit_graph_node_t *const *)a)->commit),
+                       git_commit_id((*(commit_graph_node_t *const *)b)->commit));
+}
+
+// Add many commit nodes at once, they are appended and both orders sorted
+// again instead of moving the tail for every node
+void version_index_add_many(version_index_t *versions, commit_graph_node_t **nodes, size_t count)
+{
+    if (!versions || count == 0 || version_index_reserve(versions, count) != 0)
+    {
+        return;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        versions->by_time[versions->size + i] = nodes[i];
+        versions->by_oid[versions->size + i] = nodes[i];
+    }
+    versions->size += count;
+    qsort(versions->by_time, versions->size, sizeof(commit_graph_node_t *), compare_time);
+    qsort(versions->by_oid, versions->size, sizeof(commit_graph_node_t *), compare_oid);
+}
+
+// Find version whose commit oid starts with first length hex digits of
+// prefix, NULL if no found version matches or prefix is ambiguous. A
+// commit reached along several branches has several nodes, they are
+// the same version and don't make prefix ambiguous.
+commit_graph_node_t *version_index_find_prefix(const version_index_t *versions, const git_oid *prefix, size_t length)
+{
+    if (!versions)
+    {
+        return NULL;
+    }
+    size_t position = version_index_oid_position(versions, prefix);
+    if (position >= versions->size || git_oid_ncmp(git_commit_id(versions->by_oid[position]->commit), prefix, length) != 0)
+    {
+        return NULL;
+    }
+    const git_oid *found = git_commit_id(versions->by_oid[position]->commit);
+    size_t next = position + 1;
+    while (next < versions->size && git_oid_equal(git_commit_id(versions->by_oid[next]->commit), found))
+    {
+        next++;
+    }
+    if (next < versions->size && git_oid_ncmp(git_commit_id(versions->by_oid[next]->commit), prefix, length) == 0)
+    {
+        return NULL;
+    }
+    return versions->by_oid[position];
+}
+
 // Initialize a visited set
 visited_set_t *visited_set_init(void)
 {
@@ -253,59 +1043,133 @@ visited_set_t *visited_set_init(void)
         perror("Failed to allocate memory for visited set");
         exit(EXIT_FAILURE);
     }
-    visited->list = malloc(16 * sizeof(git_oid *));
+    visited->list = calloc(64, sizeof(git_oid));
     if (!visited->list)
     {
         perror("Failed to allocate memory for visited set list");
         exit(EXIT_FAILURE);
     }
     visited->size = 0;
-    visited->capacity = 16;
+    visited->capacity = 64;
+    stats.visited_sets++;
+    stats.visited_bytes += visited->capacity * sizeof(git_oid);
     return visited;
 }
 
+static int oid_is_zero(const git_oid *oid)
+{
+    for (size_t i = 0; i < sizeof(oid->id); i++)
+    {
+        if (oid->id[i])
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Find slot holding oid or empty slot where it should go, oids are uniformly
+// distributed so their first bytes are good enough as hash
+static git_oid *visited_set_slot(git_oid *list, size_t capacity, const git_oid *oid)
+{
+    size_t hash;
+    memcpy(&hash, oid->id, sizeof(hash));
+    size_t i = hash & (capacity - 1);
+    while (!oid_is_zero(&list[i]) && !git_oid_equal(&list[i], oid))
+    {
+        i = (i + 1) & (capacity - 1);
+    }
+    return &list[i];
+}
+
 // Add an OID to the visited set
 void visited_set_add(visited_set_t *visited, const git_oid *oid)
 {
-    if (visited->size == visited->capacity)
+    // keep load factor under 1/2
+    if ((visited->size + 1) * 2 > visited->capacity)
     {
-        visited->capacity *= 2;
-        visited->list = realloc(visited->list, visited->capacity * sizeof(git_oid *));
-        if (!visited->list)
+        size_t capacity = visited->capacity * 2;
+        git_oid *list = calloc(capacity, sizeof(git_oid));
+        if (!list)
         {
             perror("Failed to reallocate memory for visited set list");
             exit(EXIT_FAILURE);
         }
+        for (size_t i = 0; i < visited->capacity; i++)
+        {
+            if (!oid_is_zero(&visited->list[i]))
+            {
+                git_oid_cpy(visited_set_slot(list, capacity, &visited->list[i]), &visited->list[i]);
+            }
+        }
+        free(visited->list);
+        stats.visited_bytes += (capacity - visited->capacity) * sizeof(git_oid);
+        visited->list = list;
+        visited->capacity = capacity;
     }
-    visited->list[visited->size] = malloc(sizeof(git_oid));
-    if (!visited->list[visited->size])
+    git_oid *slot = visited_set_slot(visited->list, visited->capacity, oid);
+    if (oid_is_zero(slot))
     {
-        perror("Failed to allocate memory for git_oid");
-        exit(EXIT_FAILURE);
+        git_oid_cpy(slot, oid);
+        visited->size++;
+        stats.visited_oids++;
     }
-    git_oid_cpy(visited->list[visited->size++], oid);
 }
 
 // Check if an OID is in the visited set
 int visited_set_contains(visited_set_t *visited, const git_oid *oid)
 {
-    for (size_t i = 0; i < visited->size; i++)
-    {
-        if (git_oid_equal(visited->list[i], oid))
-        {
-            return 1;
-        }
-    }
-    return 0;
+    return !oid_is_zero(visited_set_slot(visited->list, visited->capacity, oid));
 }
 
 // Free the visited set
 void visited_set_free(visited_set_t *visited)
 {
-    for (size_t i = 0; i < visited->size; i++)
-    {
-        free(visited->list[i]);
-    }
+    stats.visited_sets--;
+    stats.visited_oids -= visited->size;
+    stats.visited_bytes -= visited->capacity * sizeof(git_oid);
     free(visited->list);
     free(visited);
 }
+
+ancestor_search_t *ancestor_search_init(void)
+{
+    ancestor_search_t *search = malloc(sizeof(ancestor_search_t));
+    if (!search)
+    {
+        perror("Failed to allocate memory for ancestor search");
+        exit(EXIT_FAILURE);
+    }
+    search->stack = malloc(16 * sizeof(search_frame_t));
+    if (!search->stack)
+    {
+        perror("Failed to allocate memory for search stack");
+        exit(EXIT_FAILURE);
+    }
+    search->stack_size = 0;
+    search->stack_capacity = 16;
+    search->visited = visited_set_init();
+    search->entry = NULL;
+    search->next_root = 0;
+    search->commits_searched = 0;
+    search->prefetch_due = PREFETCH_INTERVAL;
+    search->paused = 0;
+    return search;
+}
+
+void ancestor_search_free(ancestor_search_t *search)
+{
+    if (!search)
+    {
+        return;
+    }
+    for (size_t i = 0; i < search->stack_size; i++)
+    {
+        stats.search_commits -= search->stack[i].commit != NULL;
+        git_commit_free(search->stack[i].commit);
+    }
+    free(search->stack);
+    visited_set_free(search->visited);
+    git_tree_entry_free(search->entry);
+    free(search);
+}
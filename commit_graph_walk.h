@@ -2,6 +2,8 @@
 #define COMMIT_GRAPH_WALK_H
 
 #include <git2.h>
+#include "commit_graph_file.h"
+#include "prefetch.h"
 
 /*
 Naming might be confusing as walking to descendants
@@ -11,45 +13,137 @@ from how commit structure in git looks like and
 we start by 'youngest' as root and find its ancestors.
 */
 
+// Return values of commit_graph_fetch_ancestors_step
+#define FETCH_ERROR -1       // node is in inconsistent state
+#define FETCH_DONE 0         // search finished in this call
+#define FETCH_ALREADY_DONE 1 // ancestors were fetched before
+#define FETCH_IN_PROGRESS 2  // budget used up, call again to continue
+
+// helper for searching through graph, open addressing hash set of oids
+typedef struct
+{
+    git_oid *list;   // Slots of the set, zero oid marks empty slot
+    size_t size;     // Current number of elements
+    size_t capacity; // Current number of slots (power of two)
+} visited_set_t;
+
+// Commit on the search stack waiting for its parents to be checked
+typedef struct
+{
+    git_oid oid;        // Commit with the same entry as searched one
+    uint32_t position;  // Position in commit-graph file, GRAPH_NO_POSITION if not there
+    git_commit *commit; // Loaded commit, only for commits missing in commit-graph file
+    size_t next_parent; // Index of next parent to check
+    int found;          // Number of ancestors found through already checked parents
+} search_frame_t;
+
+// State of unfinished ancestor search, kept in node so it can be continued later
+typedef struct
+{
+    search_frame_t *stack;   // Search frontier, path from one of node parents to currently checked commit
+    size_t stack_size;       // Current number of frames on stack
+    size_t stack_capacity;   // Current capacity of stack
+    visited_set_t *visited;  // Commits already checked
+    git_tree_entry *entry;   // Entry searched for, taken from parent search started at
+    size_t next_root;        // Index of next node commit parent to start search from
+    size_t commits_searched; // Number of commits checked so far
+    size_t prefetch_due;     // Commits pushed since frontier was last prefetched
+    int paused;              // Flag set when user stopped the search
+} ancestor_search_t;
+
+// Resolved commit nodes sorted by commit time and by commit oid, filled as
+// ancestors are found so any found version can be reached without walking
+typedef struct version_index
+{
+    struct commit_graph_node **by_time; // Oldest first
+    struct commit_graph_node **by_oid;  // Sorted by commit oid for prefix lookup
+    size_t size;                        // Current number of nodes
+    size_t capacity;                    // Current capacity of both arrays
+} version_index_t;
+
+// Kinds of graph nodes, index and working tree versions of the file are
+// virtual nodes put above HEAD, they have no commit and keep their content
+#define NODE_COMMIT 0
+#define NODE_INDEX 1
+#define NODE_WORKTREE 2
+
 // Structure representing a single node in the commit graph
 typedef struct commit_graph_node
 {
-    git_commit *commit;                   // Pointer to the associated Git commit
+    int kind;                             // NODE_COMMIT, NODE_INDEX or NODE_WORKTREE
+    git_commit *commit;                   // Pointer to the associated Git commit, NULL for virtual nodes
     git_tree_entry *entry;                // entry of the file we create graph for.
     struct commit_graph_node *descendant; // Pointer to the descendant node (commit from which this was found)
     struct commit_graph_node **ancestors; // Pointer to an array of ancestor nodes
     size_t ancestor_count;                // Number of ancestors (size of the parents array)
     int ancestors_fetched;                // Flag indicating if ancestors have been fetched (0 = not fetched, 1 = fetched)
+    ancestor_search_t *search;            // Unfinished ancestor search, NULL if not started or finished
+    commit_graph_file_t *graph_file;      // commit-graph of repository shared by all nodes, NULL if missing
+    prefetcher_t *prefetcher;             // object prefetcher shared by all nodes, NULL if repository has no packs
+    version_index_t *versions;            // index of all commit nodes of the graph, shared by all nodes
+    git_oid blob_id;                      // Blob oid of virtual node, or of commit node from cache daemon history which has no entry
+    char *content;                        // Content of virtual node
+    size_t content_size;                  // Size of content of virtual node
+    char *path;                           // File path of virtual node, working tree node is reread from it
 } commit_graph_node_t;
 
+// Content of a file version, released with commit_graph_content_release
 typedef struct
 {
-    commit_graph_node_t *current;
-} commit_graph_walk_t;
+    const char *data;
+    size_t size;
+    git_blob *blob; // set when content was looked up in process
+    void *mapping;  // set when content came from cache daemon
+} node_content_t;
 
-// helper for searching through graph
 typedef struct
 {
-    git_oid **list;  // Array of pointers to git_oid
-    size_t size;     // Current number of elements
-    size_t capacity; // Current capacity of the list
-} visited_set_t;
+    commit_graph_node_t *current;
+    commit_graph_file_t *graph_file; // owned by walk created with commit_graph_walk_init
+    prefetcher_t *prefetcher;        // owned by walk created with commit_graph_walk_init
+    version_index_t *versions;       // owned by walk created with commit_graph_walk_init
+    int shared_files;                // graph_file and prefetcher belong to the caller
+} commit_graph_walk_t;
 
 commit_graph_node_t *commit_graph_node_init(void);
 void commit_graph_node_free(commit_graph_node_t *node);
 commit_graph_walk_t *commit_graph_walk_init(git_commit *start_commit, const char *_filename);
+commit_graph_walk_t *commit_graph_walk_init_shared(git_commit *start_commit, const char *filename, commit_graph_file_t *graph_file, prefetcher_t *prefetcher);
 void commit_graph_walk_free(commit_graph_walk_t *walk);
 int commit_graph_fetch_ancestors(commit_graph_node_t *node);
-int search_git_tree_for_oldest_with_entry(git_commit *commit, commit_graph_node_t *for_result, visited_set_t *visited, const git_tree_entry *entry);
+int commit_graph_fetch_ancestors_step(commit_graph_node_t *node, size_t commit_budget, double time_budget_ms);
+void commit_graph_search_pause(commit_graph_node_t *node);
+void commit_graph_search_resume(commit_graph_node_t *node);
+int commit_graph_search_active(commit_graph_node_t *node);
 void add_ancestor(commit_graph_node_t *node, git_commit *commit, const git_tree_entry *entry);
 int commit_graph_walk_to_ancestor(commit_graph_walk_t *walk, int ancestor_index);
 int commit_graph_walk_to_descendant(commit_graph_walk_t *walk);
+commit_graph_node_t *commit_graph_walk_add_worktree(commit_graph_walk_t *walk, const char *path);
+int commit_graph_node_reload_worktree(commit_graph_node_t *node);
+commit_graph_node_t *commit_graph_node_commit(commit_graph_node_t *node);
+int commit_graph_node_content(commit_graph_node_t *node, node_content_t *content);
+void commit_graph_content_release(node_content_t *content);
+int commit_graph_node_add_history(commit_graph_node_t *node, const git_oid *commits, const git_oid *blobs, const long *descendants, size_t count);
+const git_oid *commit_graph_node_blob_id(const commit_graph_node_t *node);
+const char *commit_graph_node_name(const commit_graph_node_t *node);
+int commit_graph_goto_step(version_index_t *versions, git_time_t time, size_t commit_budget, double time_budget_ms, commit_graph_node_t **target);
+int commit_graph_goto_commit_step(version_index_t *versions, git_commit *commit, const git_oid *blob, size_t commit_budget, double time_budget_ms, commit_graph_node_t **target);
 
 visited_set_t *visited_set_init(void);
 void visited_set_free(visited_set_t *visited);
 void visited_set_add(visited_set_t *visited, const git_oid *oid);
 int visited_set_contains(visited_set_t *visited, const git_oid *oid);
 
+version_index_t *version_index_init(void);
+void version_index_free(version_index_t *versions);
+void version_index_add(version_index_t *versions, commit_graph_node_t *node);
+void version_index_add_many(version_index_t *versions, commit_graph_node_t **nodes, size_t count);
+size_t version_index_count_until(const version_index_t *versions, git_time_t time);
+commit_graph_node_t *version_index_find_prefix(const version_index_t *versions, const git_oid *prefix, size_t length);
+
+ancestor_search_t *ancestor_search_init(void);
+void ancestor_search_free(ancestor_search_t *search);
+
 // void search_git_tree_for_changed_file(git_commit *commit, commit_graph_node_t *search_root, visited_set_t *visited, git_tree_entry *file);
 
 #endif
@@ -0,0 +1,328 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "git_tuning.h"
+
+static const char *setting_keys[TUNING_COUNT] = {
+    "cache-max-size",
+    "cache-commit-limit",
+    "cache-tree-limit",
+    "cache-blob-limit",
+    "cache-tag-limit",
+    "mwindow-size",
+    "mwindow-mapped-limit",
+};
+
+// Defaults of libgit2 for the cache, mmap window defaults are read back
+#define DEFAULT_CACHE_MAX_SIZE ((size_t)256 << 20)
+// Auto mode keeps the cache within this share of available memory
+#define AUTO_MEMORY_SHARE 4
+// Wide directories have trees over libgit2's 4 KiB limit, and the tree
+// of every commit on the way is looked up by ancestor search
+#define AUTO_TREE_LIMIT ((size_t)1 << 20)
+#define AUTO_COMMIT_LIMIT ((size_t)64 << 10)
+
+// Config file, QDIFF_CONFIG overrides default per user location
+void git_tuning_config_path(char *out, size_t size)
+{
+    const char *path = getenv("QDIFF_CONFIG");
+    const char *config_home = getenv("XDG_CONFIG_HOME");
+    const char *home = getenv("HOME");
+    if (path && *path)
+    {
+        snprintf(out, size, "%s", path);
+    }
+    else if (config_home && *config_home)
+    {
+        snprintf(out, size, "%s/qdiff/config", config_home);
+    }
+    else
+    {
+        snprintf(out, size, "%s/.config/qdiff/config", home ? home : "");
+    }
+}
+
+// Parse byte count with optional K, M or G suffix, returns -1 if invalid
+static int parse_size(const char *text, size_t *out)
+{
+    char *end;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text || *text == '-')
+    {
+        return -1;
+    }
+    int shift = 0;
+    switch (toupper((unsigned char)*end))
+    {
+    case 'K':
+        shift = 10;
+        end++;
+        break;
+    case 'M':
+        shift = 20;
+        end++;
+        break;
+    case 'G':
+        shift = 30;
+        end++;
+        break;
+    }
+    if (*end != '\0')
+    {
+        return -1;
+    }
+    *out = (size_t)value << shift;
+    return 0;
+}
+
+// Set one value by its key, returns 0 on success and -1 for unknown key
+// or invalid value
+int git_tuning_set(git_tuning_t *tuning, const char *key, const char *value)
+{
+    if (strcmp(key, "cache-auto") == 0)
+    {
+        tuning->auto_size = strcmp(value, "yes") == 0 || strcmp(value, "1") == 0;
+        return tuning->auto_size || strcmp(value, "no") == 0 || strcmp(value, "0") == 0 ? 0 : -1;
+    }
+    for (int i = 0; i < TUNING_COUNT; i++)
+    {
+        if (strcmp(key, setting_keys[i]) == 0)
+        {
+            if (parse_size(value, &tuning->values[i]) != 0)
+            {
+                return -1;
+            }
+            tuning->set[i] = 1;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Check if command line argument is one of tuning flags
+int git_tuning_is_flag(const char *arg)
+{
+    return strncmp(arg, "--cache-", 8) == 0 || strncmp(arg, "--mwindow-", 10) == 0;
+}
+
+// Take tuning flag at argv[*i] and its value, --cache-auto has none.
+// Returns 0 on success, unknown flag or invalid value is reported and -1
+// returned.
+int git_tuning_flag(git_tuning_t *tuning, int argc, char *argv[], int *i)
+{
+    if (strcmp(argv[*i], "--cache-auto") == 0)
+    {
+        tuning->auto_size = 1;
+        return 0;
+    }
+    if (*i + 1 >= argc || git_tuning_set(tuning, argv[*i] + 2, argv[*i + 1]) != 0)
+    {
+        fprintf(stderr, "Invalid setting %s\n", argv[*i]);
+        return -1;
+    }
+    *i += 1;
+    return 0;
+}
+
+// Strip leading and trailing whitespace in place
+static char *trim(char *text)
+{
+    while (isspace((unsigned char)*text))
+    {
+        text++;
+    }
+    size_t length = strlen(text);
+    while (length > 0 && isspace((unsigned char)text[length - 1]))
+    {
+        text[--length] = '\0';
+    }
+    return text;
+}
+
+// Read settings from config file. Missing file is not an error, invalid
+// lines are reported and skipped. Returns number of invalid lines.
+int git_tuning_load(git_tuning_t *tuning, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        return 0;
+    }
+    char line[256];
+    int line_number = 0;
+    int invalid = 0;
+    while (fgets(line, sizeof(line), file))
+    {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment)
+        {
+            *comment = '\0';
+        }
+        char *key = trim(line);
+        if (*key == '\0')
+        {
+            continue;
+        }
+        char *separator = strchr(key, '=');
+        if (separator)
+        {
+            *separator = '\0';
+        }
+        if (!separator || git_tuning_set(tuning, trim(key), trim(separator + 1)) != 0)
+        {
+            fprintf(stderr, "%s:%d: invalid setting\n", path, line_number);
+            invalid++;
+        }
+    }
+    fclose(file);
+    return invalid;
+}
+
+// Total size of pack files of repository
+static size_t pack_size(git_repository *repo)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%sobjects/pack", git_repository_commondir(repo));
+    DIR *dir = opendir(path);
+    if (!dir)
+    {
+        return 0;
+    }
+    size_t total = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)))
+    {
+        size_t length = strlen(entry->d_name);
+        char file[4096 + 256];
+        struct stat info;
+        if (length > 5 && strcmp(entry->d_name + length - 5, ".pack") == 0 &&
+            snprintf(file, sizeof(file), "%s/%s", path, entry->d_name) > 0 && stat(file, &info) == 0)
+        {
+            total += info.st_size;
+        }
+    }
+    closedir(dir);
+    return total;
+}
+
+// MemAvailable of /proc/meminfo, 0 when unknown
+static size_t memory_available(void)
+{
+    FILE *file = fopen("/proc/meminfo", "r");
+    if (!file)
+    {
+        return 0;
+    }
+    char line[128];
+    unsigned long long kib = 0;
+    while (fgets(line, sizeof(line), file))
+    {
+        if (sscanf(line, "MemAvailable: %llu kB", &kib) == 1)
+        {
+            break;
+        }
+    }
+    fclose(file);
+    return (size_t)kib << 10;
+}
+
+// Pick values not set explicitly from pack size of repository and available
+// memory, when auto mode is on. Cache grows with the packs up to a share
+// of available memory, large trees and commits get cached and all packs
+// can stay mapped at once. Without repository only memory is considered.
+void git_tuning_auto(git_tuning_t *tuning, git_repository *repo)
+{
+    if (!tuning->auto_size)
+    {
+        return;
+    }
+    size_t packs = repo ? pack_size(repo) : 0;
+    size_t budget = memory_available() / AUTO_MEMORY_SHARE;
+    if (!tuning->set[TUNING_CACHE_MAX_SIZE])
+    {
+        size_t size = packs > DEFAULT_CACHE_MAX_SIZE ? packs : DEFAULT_CACHE_MAX_SIZE;
+        tuning->values[TUNING_CACHE_MAX_SIZE] = budget && size > budget ? budget : size;
+        tuning->set[TUNING_CACHE_MAX_SIZE] = 1;
+    }
+    if (!tuning->set[TUNING_CACHE_TREE_LIMIT])
+    {
+        tuning->values[TUNING_CACHE_TREE_LIMIT] = AUTO_TREE_LIMIT;
+        tuning->set[TUNING_CACHE_TREE_LIMIT] = 1;
+    }
+    if (!tuning->set[TUNING_CACHE_COMMIT_LIMIT])
+    {
+        tuning->values[TUNING_CACHE_COMMIT_LIMIT] = AUTO_COMMIT_LIMIT;
+        tuning->set[TUNING_CACHE_COMMIT_LIMIT] = 1;
+    }
+    // address space is only plentiful with 64-bit pointers
+    size_t mapped_limit = 0;
+    git_libgit2_opts(GIT_OPT_GET_MWINDOW_MAPPED_LIMIT, &mapped_limit);
+    size_t wanted = packs + packs / 4;
+    if (!tuning->set[TUNING_MWINDOW_MAPPED_LIMIT] && sizeof(void *) == 8 && wanted > mapped_limit)
+    {
+        tuning->values[TUNING_MWINDOW_MAPPED_LIMIT] = wanted;
+        tuning->set[TUNING_MWINDOW_MAPPED_LIMIT] = 1;
+    }
+}
+
+// Hand set values to libgit2, options are global for the process
+void git_tuning_apply(const git_tuning_t *tuning)
+{
+    const git_object_t types[] = {GIT_OBJECT_COMMIT, GIT_OBJECT_TREE, GIT_OBJECT_BLOB, GIT_OBJECT_TAG};
+    if (tuning->set[TUNING_CACHE_MAX_SIZE])
+    {
+        git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, (ssize_t)tuning->values[TUNING_CACHE_MAX_SIZE]);
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        if (tuning->set[TUNING_CACHE_COMMIT_LIMIT + i])
+        {
+            git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, types[i], tuning->values[TUNING_CACHE_COMMIT_LIMIT + i]);
+        }
+    }
+    if (tuning->set[TUNING_MWINDOW_SIZE])
+    {
+        git_libgit2_opts(GIT_OPT_SET_MWINDOW_SIZE, tuning->values[TUNING_MWINDOW_SIZE]);
+    }
+    if (tuning->set[TUNING_MWINDOW_MAPPED_LIMIT])
+    {
+        git_libgit2_opts(GIT_OPT_SET_MWINDOW_MAPPED_LIMIT, tuning->values[TUNING_MWINDOW_MAPPED_LIMIT]);
+    }
+}
+
+// One line of set values for --timing output, "libgit2 defaults" if none
+void git_tuning_format(const git_tuning_t *tuning, char *out, size_t size)
+{
+    size_t used = snprintf(out, size, "libgit2:");
+    int any = 0;
+    for (int i = 0; i < TUNING_COUNT && used < size; i++)
+    {
+        if (tuning->set[i])
+        {
+            // largest unit the value is a whole multiple of, so it reads
+            // back exactly as applied
+            size_t value = tuning->values[i];
+            const char *suffix = "";
+            if (value && value % ((size_t)1 << 20) == 0)
+            {
+                value >>= 20;
+                suffix = "M";
+            }
+            else if (value && value % ((size_t)1 << 10) == 0)
+            {
+                value >>= 10;
+                suffix = "K";
+            }
+            used += snprintf(out + used, size - used, " %s %zu%s", setting_keys[i], value, suffix);
+            any = 1;
+        }
+    }
+    if (!any)
+    {
+        snprintf(out, size, "libgit2: defaults");
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef GIT_TUNING_H
+#define GIT_TUNING_H
+
+#include <stddef.h>
+#include <git2.h>
+
+/*
+Settings of libgit2 object cache and pack file mmap windows. They are
+read from a config file of "key = value" lines ('#' starts a comment),
+QDIFF_CONFIG overrides the default $XDG_CONFIG_HOME/qdiff/config, and
+command line flags --<key> <value> override the file:
+
+    cache-max-size        total size of cached objects
+    cache-commit-limit    largest commit, tree, blob and tag which
+    cache-tree-limit      is still cached, 0 for blobs means they
+    cache-blob-limit      aren't cached at all
+    cache-tag-limit
+    mwindow-size          size of one mmap window into a pack
+    mwindow-mapped-limit  total size of mapped pack windows
+    cache-auto            yes to size unset values from pack size and
+                          available memory, as flag it takes no value
+
+Sizes take K, M and G suffixes. Unset values keep libgit2 defaults.
+*/
+
+typedef enum
+{
+    TUNING_CACHE_MAX_SIZE,
+    TUNING_CACHE_COMMIT_LIMIT,
+    TUNING_CACHE_TREE_LIMIT,
+    TUNING_CACHE_BLOB_LIMIT,
+    TUNING_CACHE_TAG_LIMIT,
+    TUNING_MWINDOW_SIZE,
+    TUNING_MWINDOW_MAPPED_LIMIT,
+    TUNING_COUNT
+} git_tuning_setting;
+
+typedef struct
+{
+    size_t values[TUNING_COUNT];
+    unsigned char set[TUNING_COUNT]; // value was given in config or flags
+    int auto_size;
+} git_tuning_t;
+
+void git_tuning_config_path(char *out, size_t size);
+int git_tuning_set(git_tuning_t *tuning, const char *key, const char *value);
+int git_tuning_is_flag(const char *arg);
+int git_tuning_flag(git_tuning_t *tuning, int argc, char *argv[], int *i);
+int git_tuning_load(git_tuning_t *tuning, const char *path);
+void git_tuning_auto(git_tuning_t *tuning, git_repository *repo);
+void git_tuning_apply(const git_tuning_t *tuning);
+void git_tuning_format(const git_tuning_t *tuning, char *out, size_t size);
+
+#endif
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "line_store.h"
+#include "stats.h"
+
+static line_store_entry store[LINE_STORE_SIZE];
+static int store_used = 0;
+static unsigned long store_tick = 0;
+
+// Number of display columns text takes, tabs go to next tab stop
+int line_store_text_width(const char *text, int length)
+{
+    int column = 0;
+    for (int i = 0; i < length && text[i] != '\n'; i++)
+    {
+        column += text[i] == '\t' ? TAB_WIDTH - column % TAB_WIDTH : 1;
+    }
+    return column;
+}
+
+static void line_store_clear(line_store_entry *entry)
+{
+    stats.line_bytes -= entry->size + entry->lines_count * sizeof(stored_line);
+    commit_graph_content_release(&entry->content);
+    free(entry->copy);
+    free(entry->lines);
+    entry->copy = NULL;
+    entry->data = NULL;
+    entry->lines = NULL;
+    entry->size = 0;
+    entry->lines_count = 0;
+}
+
+// Split content of node version into lines. Blobs and daemon mappings are
+// used in place, so processes showing a blob served by the daemon share
+// its pages. Content of index and working tree nodes is copied, it is
+// replaced when the working tree file is reread.
+static void line_store_fill(line_store_entry *entry, commit_graph_node_t *node)
+{
+    commit_graph_node_content(node, &entry->content);
+    entry->size = entry->content.size;
+    entry->data = entry->content.data;
+    if (node->kind != NODE_COMMIT)
+    {
+        entry->copy = malloc(entry->size ? entry->size : 1);
+        if (!entry->copy)
+        {
+            perror("Failed to allocate memory for line store");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(entry->copy, entry->content.data, entry->size);
+        commit_graph_content_release(&entry->content);
+        entry->data = entry->copy;
+    }
+
+    int lines_count = 0;
+    for (size_t i = 0; i < entry->size; i++)
+    {
+        lines_count += entry->data[i] == '\n';
+    }
+    lines_count += entry->size > 0 && entry->data[entry->size - 1] != '\n';
+    entry->lines = malloc((lines_count ? lines_count : 1) * sizeof(stored_line));
+    if (!entry->lines)
+    {
+        perror("Failed to allocate memory for line store");
+        exit(EXIT_FAILURE);
+    }
+    entry->lines_count = 0;
+    size_t line_start = 0;
+    for (size_t i = 0; i < entry->size; i++)
+    {
+        if (entry->data[i] == '\n' || i == entry->size - 1)
+        {
+            stored_line *line = &entry->lines[entry->lines_count++];
+            line->text = entry->data + line_start;
+            line->length = i + 1 - line_start;
+            line->width = line_store_text_width(line->text, line->length);
+            line_start = i + 1;
+        }
+    }
+    stats.line_bytes += entry->size + entry->lines_count * sizeof(stored_line);
+}
+
+// Get lines of version shown by node, blob is read and split only when no
+// pane showed it recently. Entry has to be released with line_store_release.
+line_store_entry *line_store_get(commit_graph_node_t *node)
+{
+    const git_oid *blob_id = commit_graph_node_blob_id(node);
+    store_tick++;
+    for (int i = 0; i < store_used; i++)
+    {
+        if (git_oid_equal(&store[i].blob_id, blob_id))
+        {
+            store[i].references++;
+            store[i].used = store_tick;
+            return &store[i];
+        }
+    }
+    line_store_entry *entry = NULL;
+    if (store_used < LINE_STORE_SIZE)
+    {
+        entry = &store[store_used++];
+    }
+    else
+    {
+        for (int i = 0; i < store_used; i++)
+        {
+            if (store[i].references == 0 && (!entry || store[i].used < entry->used))
+            {
+                entry = &store[i];
+            }
+        }
+        if (!entry)
+        {
+            fprintf(stderr, "Line store is full\n");
+            exit(EXIT_FAILURE);
+        }
+        line_store_clear(entry);
+    }
+    git_oid_cpy(&entry->blob_id, blob_id);
+    entry->references = 1;
+    entry->used = store_tick;
+    line_store_fill(entry, node);
+    return entry;
+}
+
+// Entry stays cached until its slot is needed for another blob
+void line_store_release(line_store_entry *entry)
+{
+    if (entry)
+    {
+        entry->references--;
+    }
+}
+
+void line_store_free(void)
+{
+    for (int i = 0; i < store_used; i++)
+    {
+        line_store_clear(&store[i]);
+    }
+    store_used = 0;
+}
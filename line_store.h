@@ -0,0 +1,39 @@
+#ifndef LINE_STORE_H
+#define LINE_STORE_H
+
+#include <git2.h>
+#include "commit_graph_walk.h"
+
+// Number of blobs kept split into lines, entries not shown by any pane
+// are evicted least recently used first
+#define LINE_STORE_SIZE 32
+
+#define TAB_WIDTH 8
+
+typedef struct
+{
+    const char *text; // points into entry data, not NUL terminated
+    int length;       // newline included
+    int width;        // display columns of text, tabs expanded, without newline
+} stored_line;
+
+// Content of one blob split into lines, shared by all panes showing it
+typedef struct
+{
+    git_oid blob_id;
+    const char *data;       // raw blob content, in content or copy
+    size_t size;
+    node_content_t content; // blob or daemon mapping held while entry is filled
+    char *copy;             // content of virtual nodes, which can change under it
+    stored_line *lines;
+    int lines_count;
+    int references;     // panes showing this blob
+    unsigned long used; // tick of last use
+} line_store_entry;
+
+int line_store_text_width(const char *text, int length);
+line_store_entry *line_store_get(commit_graph_node_t *node);
+void line_store_release(line_store_entry *entry);
+void line_store_free(void);
+
+#endif
@@ -1,10 +1,17 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <git2.h>
 #include <unistd.h>
 #include <ncurses.h>
 #include <libgen.h>
-#include "commit_graph_walk.h"
-#include "windows.h"
+#include "app.h"
+#include "timer.h"
+#include "syntax.h"
+#include "line_store.h"
+#include "cache_client.h"
+#include "stats.h"
+#include "git_tuning.h"
 
 void libgit_error_check(int error)
 {
@@ -18,21 +25,96 @@ void libgit_error_check(int error)
     }
 }
 
+// Startup pipeline timestamps, in ms since start of main
+typedef struct
+{
+    double repo_open;
+    double first_paint;
+    double history_resolved;
+    size_t prefetch_reads; // objects read by ancestor search
+    size_t prefetch_hits;  // of those, already prefetched
+    size_t prefetched;
+} startup_timing;
+
+void print_startup_timing(const startup_timing *timing, const git_tuning_t *tuning)
+{
+    char settings[256];
+    git_tuning_format(tuning, settings, sizeof(settings));
+    fprintf(stderr, "%s\n", settings);
+    fprintf(stderr, "startup: repository opened %.1f ms, first paint %.1f ms, ", timing->repo_open, timing->first_paint);
+    if (timing->history_resolved >= 0)
+    {
+        fprintf(stderr, "history resolved %.1f ms\n", timing->history_resolved);
+    }
+    else
+    {
+        fprintf(stderr, "history not resolved\n");
+    }
+    fprintf(stderr, "prefetch: %zu objects prefetched, %zu of %zu reads hit (%.1f%%)\n",
+            timing->prefetched, timing->prefetch_hits, timing->prefetch_reads,
+            timing->prefetch_reads ? 100.0 * timing->prefetch_hits / timing->prefetch_reads : 0.0);
+}
+
 int main(int argc, char *argv[])
 {
-    if (argc < 2)
+    double start_time = timer_now_ms();
+    startup_timing timing = {-1, -1, -1, 0, 0, 0};
+    int show_timing = 0;
+    int use_daemon = 1;
+    int show_stats = 0;
+    char *filepath = NULL;
+    // config file first, flags override it
+    git_tuning_t tuning = {0};
+    char config_path[4096];
+    git_tuning_config_path(config_path, sizeof(config_path));
+    git_tuning_load(&tuning, config_path);
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--timing") == 0)
+        {
+            show_timing = 1;
+        }
+        else if (strcmp(argv[i], "--stats") == 0)
+        {
+            show_stats = 1;
+        }
+        else if (strcmp(argv[i], "--no-daemon") == 0)
+        {
+            use_daemon = 0;
+        }
+        else if (git_tuning_is_flag(argv[i]))
+        {
+            if (git_tuning_flag(&tuning, argc, argv, &i) != 0)
+            {
+                return 1;
+            }
+        }
+        else
+        {
+            filepath = argv[i];
+        }
+    }
+    if (!filepath)
     {
         fprintf(stderr, "Missing filepath\n");
         return 1;
     }
-    const char *filepath = argv[1];
-    const char *filename = basename(argv[1]);
+    const char *filename = basename(filepath);
 
     // libgit initialization and looking if there is a repository in the given location
     git_libgit2_init();
     git_repository *repo = NULL;
     int error = git_repository_open_ext(&repo, filepath, 0, NULL);
     libgit_error_check(error);
+    // cache and pack window settings are in place before any object is read
+    git_tuning_auto(&tuning, repo);
+    git_tuning_apply(&tuning);
+    timing.repo_open = timer_now_ms() - start_time;
+    // without a running cache daemon everything is done in process
+    if (use_daemon)
+    {
+        cache_client_connect();
+    }
 
     // Getting starting data (commit pointed by HEAD)
     git_commit *head_commit = NULL;
@@ -42,224 +124,34 @@ int main(int argc, char *argv[])
     error = git_commit_lookup(&head_commit, repo, &commit_oid);
     libgit_error_check(error);
 
-    // Initialize commit graph walk and free unnecesary commit object
-    commit_graph_walk_t *hold_walk = commit_graph_walk_init(head_commit, filename);
+    // Initialize app, it paints starting commit before any history search
+    app_t *app = app_init(&ncurses_backend, head_commit, filepath, filename);
     git_commit_free(head_commit);
+    timing.first_paint = timer_now_ms() - start_time;
 
-    // ncurses initialization and window setup
-    initscr();
-    cbreak();
-    noecho();
-    curs_set(0);
-    keypad(stdscr, TRUE);
-    commit_display *l_display = NULL;
-    commit_display *r_display = NULL;
-    l_display = commit_display_init(LINES, COLS, 0, 0, hold_walk);
-    start_color();
-    use_default_colors();
-    init_pair(1, COLOR_CYAN, -1);
-    init_pair(2, COLOR_GREEN, -1);
-    init_pair(3, COLOR_RED, -1);
-    clear();
-    refresh();
-    commit_display *active = l_display;
-
-    // Display starting commit
-    commit_display_load_buffer(l_display);
-    commit_display_update(l_display);
-    doupdate();
+    app_run(app);
 
-    // User input loop
-    int user_input;
-    while ((user_input = getch()) != 'q')
+    // Cleanup
+    if (app->history_resolved >= 0)
     {
-        switch (user_input)
-        {
-        case KEY_RESIZE:
-            handle_resize(l_display, r_display);
-            break;
-        case 'i':
-            if (r_display)
-            {
-                if (active == l_display)
-                {
-                    active = r_display;
-                }
-                else
-                {
-                    active = l_display;
-                }
-            }
-            break;
-        case 's':
-            if (r_display)
-            {
-                if (active == l_display)
-                {
-                    commit_display_free(r_display);
-                }
-                else
-                {
-                    commit_display_free(l_display);
-                    l_display = r_display;
-                    l_display->walk->current = r_display->walk->current;
-                    active = r_display;
-                }
-                r_display = NULL;
-                commit_display_reset_diff(active);
-                handle_resize(l_display, r_display);
-            }
-            else
-            {
-                hold_walk->current = active->walk->current;
-                r_display = commit_display_init(LINES, COLS, 0, 0, hold_walk);
-                commit_display_load_buffer(r_display);
-                commit_display_update(r_display);
-                handle_resize(l_display, r_display);
-            }
-            break;
-        default:
-            if (active->menu_state)
-            {
-                switch (user_input) // handle h, j, k, l on menu display
-                {
-                case 'h':
-                case KEY_LEFT:
-                    commit_graph_walk_to_ancestor(active->walk, active->menu_state - 1);
-                    active->menu_state = 0;
-                    active->y_offset = 0;
-                    commit_display_load_buffer(active);
-                    commit_display_get_diff(l_display, r_display);
-                    if (r_display)
-                    {
-                        commit_display_update_file(active == r_display ? l_display : r_display);
-                    }
-                    commit_display_update(active);
-                    doupdate();
-                    break;
-                case KEY_RIGHT:
-                case 'l':
-                    active->menu_state = 0;
-                    commit_display_update_file(active);
-                    doupdate();
-                    break;
-                case KEY_DOWN:
-                case 'j':
-                    if (active->menu_state < active->walk->current->ancestor_count)
-                    {
-                        active->menu_state++;
-                        commit_display_update_menu(active);
-                        doupdate();
-                    }
-                    else
-                    {
-                        beep();
-                    }
-                    break;
-                case KEY_UP:
-                case 'k':
-                    if (active->menu_state > 1)
-                    {
-                        active->menu_state--;
-                        commit_display_update_menu(active);
-                        doupdate();
-                    }
-                    else
-                    {
-                        beep();
-                    }
-                    break;
-                }
-            }
-            else
-            {
-                switch (user_input) // handle h, j, k, l on file display
-                {
-                case KEY_LEFT:
-                case 'h':
-                    if (active->walk->current->ancestor_count > 1)
-                    {
-                        active->menu_state = 1;
-                        commit_display_update_menu(active);
-                        doupdate();
-                    }
-                    else if (active->walk->current->ancestor_count > 0)
-                    {
-                        commit_graph_walk_to_ancestor(active->walk, 0);
-                        active->y_offset = 0;
-                        commit_display_load_buffer(active);
-                        commit_display_get_diff(l_display, r_display);
-                        if (r_display)
-                        {
-                            commit_display_update_file(active == r_display ? l_display : r_display);
-                        }
-                        commit_display_update(active);
-                        doupdate();
-                    }
-                    else
-                    {
-                        beep();
-                    }
-                    break;
-                case KEY_RIGHT:
-                case 'l':
-                    if (active->walk->current->descendant)
-                    {
-                        commit_graph_walk_to_descendant(active->walk);
-                        active->y_offset = 0;
-                        commit_display_load_buffer(active);
-                        commit_display_get_diff(l_display, r_display);
-                        if (r_display)
-                        {
-                            commit_display_update_file(active == r_display ? l_display : r_display);
-                        }
-                        commit_display_update(active);
-                        doupdate();
-                    }
-                    else
-                    {
-                        beep();
-                    }
-                    break;
-                case KEY_DOWN:
-                case 'j':
-                    if (active->y_offset < active->buffer_lines_count)
-                    {
-                        active->y_offset++;
-                        commit_display_update(active);
-                        doupdate();
-                    }
-                    else
-                    {
-                        beep();
-                    }
-                    break;
-                case KEY_UP:
-                case 'k':
-                    if (active->y_offset > 0)
-                    {
-                        active->y_offset--;
-                        commit_display_update(active);
-                        doupdate();
-                    }
-                    else
-                    {
-                        beep();
-                    }
-                    break;
-                }
-            }
-            break;
-        }
+        timing.history_resolved = app->history_resolved - start_time;
     }
-
-    // Cleanup
-    clear();
-    nocbreak();
-    attrset(A_NORMAL);
-    endwin();
-    system("stty sane");
-    commit_graph_walk_free(hold_walk);
+    prefetcher_stats(app->hold_walk->prefetcher, &timing.prefetch_reads, &timing.prefetch_hits, &timing.prefetched);
+    // stats are taken while session state is still held, printed once terminal is restored
+    char stats_lines[STATS_LINES][STATS_LINE_MAX];
+    size_t stats_count = stats_format(stats_lines, STATS_LINES);
+    app_free(app);
+    if (show_timing)
+    {
+        print_startup_timing(&timing, &tuning);
+    }
+    for (size_t i = 0; show_stats && i < stats_count; i++)
+    {
+        fprintf(stderr, "%s\n", stats_lines[i]);
+    }
+    syntax_cache_free();
+    line_store_free();
+    cache_client_disconnect();
     git_repository_free(repo);
     git_libgit2_shutdown();
 
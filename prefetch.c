@@ -0,0 +1,408 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "prefetch.h"
+#include "commit_graph_walk.h"
+
+#define IDX_SIGNATURE 0xff744f63
+#define IDX_HEADER_SIZE 8
+#define IDX_FANOUT_SIZE (256 * 4)
+#define IDX_LARGE_OFFSET 0x80000000
+#define PACK_TRAILER_SIZE 20
+// Ranges closer than this are read together, also the length read from
+// the start of each object, whose size isn't known without inflating it
+#define PREFETCH_MERGE_GAP 4096
+#define PREFETCH_READ_CHUNK 65536
+// Requested and prefetched oids are forgotten past this many, objects
+// requested again after that are only read from page cache once more
+#define PREFETCH_REMEMBER_MAX 65536
+
+typedef struct
+{
+    unsigned char *idx;  // mapped .idx file
+    size_t idx_size;
+    uint32_t objects_count;
+    int pack_fd;         // .pack file, read through to fill page cache
+    uint64_t pack_size;
+} pack_index;
+
+// Part of pack file waiting to be read
+typedef struct
+{
+    pack_index *pack;
+    uint64_t start;
+    uint64_t end;
+} pack_range;
+
+struct prefetcher
+{
+    pack_index *packs;
+    size_t packs_count;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int stop;
+    git_oid *pending;          // requested and not yet read, guarded by lock
+    size_t pending_count;
+    size_t pending_capacity;
+    visited_set_t *requested;  // everything requested so far, guarded by lock
+    visited_set_t *done;       // objects already read into page cache, guarded by lock
+    size_t reads;              // objects read by search
+    size_t hits;               // of those, already prefetched
+    size_t prefetched;         // objects read into page cache, also the forgotten ones
+};
+
+static uint32_t get_be32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint64_t get_be64(const unsigned char *p)
+{
+    return (uint64_t)get_be32(p) << 32 | get_be32(p + 4);
+}
+
+// Map version 2 pack index and open its pack, returns 0 on success
+static int pack_index_open(pack_index *pack, const char *idx_path)
+{
+    int fd = open(idx_path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < IDX_HEADER_SIZE + IDX_FANOUT_SIZE)
+    {
+        close(fd);
+        return -1;
+    }
+    pack->idx = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (pack->idx == MAP_FAILED)
+    {
+        return -1;
+    }
+    pack->idx_size = st.st_size;
+    pack->objects_count = get_be32(pack->idx + IDX_HEADER_SIZE + 255 * 4);
+    if (get_be32(pack->idx) != IDX_SIGNATURE || get_be32(pack->idx + 4) != 2 ||
+        IDX_HEADER_SIZE + IDX_FANOUT_SIZE + (size_t)pack->objects_count * 28 > pack->idx_size)
+    {
+        munmap(pack->idx, pack->idx_size);
+        return -1;
+    }
+
+    char pack_path[4096];
+    snprintf(pack_path, sizeof(pack_path), "%.*s.pack", (int)(strlen(idx_path) - 4), idx_path);
+    pack->pack_fd = open(pack_path, O_RDONLY);
+    if (pack->pack_fd < 0 || fstat(pack->pack_fd, &st) != 0)
+    {
+        if (pack->pack_fd >= 0)
+        {
+            close(pack->pack_fd);
+        }
+        munmap(pack->idx, pack->idx_size);
+        return -1;
+    }
+    pack->pack_size = st.st_size;
+    return 0;
+}
+
+// Offset of object at given position of index, 0 if it is out of index
+static uint64_t pack_index_offset(const pack_index *pack, uint32_t position)
+{
+    const unsigned char *offsets = pack->idx + IDX_HEADER_SIZE + IDX_FANOUT_SIZE + (size_t)pack->objects_count * (GIT_OID_RAWSZ + 4);
+    uint32_t offset = get_be32(offsets + (size_t)position * 4);
+    if (!(offset & IDX_LARGE_OFFSET))
+    {
+        return offset;
+    }
+    const unsigned char *large = offsets + (size_t)pack->objects_count * 4 + (size_t)(offset & ~IDX_LARGE_OFFSET) * 8;
+    return large + 8 <= pack->idx + pack->idx_size ? get_be64(large) : 0;
+}
+
+// Offset of object in pack, returns 0 if pack doesn't have it
+static uint64_t pack_index_find(const pack_index *pack, const git_oid *oid)
+{
+    const unsigned char *fanout = pack->idx + IDX_HEADER_SIZE;
+    const unsigned char *oids = fanout + IDX_FANOUT_SIZE;
+    uint32_t low = oid->id[0] ? get_be32(fanout + (oid->id[0] - 1) * 4) : 0;
+    uint32_t high = get_be32(fanout + oid->id[0] * 4);
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        int compare = memcmp(oids + (size_t)middle * GIT_OID_RAWSZ, oid->id, GIT_OID_RAWSZ);
+        if (compare == 0)
+        {
+            return pack_index_offset(pack, middle);
+        }
+        if (compare < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return 0;
+}
+
+// End of read ahead of object starting at offset. The index has no object
+// sizes and finding the next object would take offsets of the whole pack
+// sorted, so a fixed length is read, clamped to the pack.
+static uint64_t pack_object_end(const pack_index *pack, uint64_t offset)
+{
+    uint64_t end = pack->pack_size - PACK_TRAILER_SIZE;
+    return offset + PREFETCH_MERGE_GAP < end ? offset + PREFETCH_MERGE_GAP : end;
+}
+
+static int compare_ranges(const void *a, const void *b)
+{
+    const pack_range *x = a;
+    const pack_range *y = b;
+    if (x->pack != y->pack)
+    {
+        return x->pack < y->pack ? -1 : 1;
+    }
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+// Read batch of objects in pack order, merging nearby ranges into one read
+static void prefetch_batch(prefetcher_t *prefetcher, const git_oid *oids, size_t count, char *scratch)
+{
+    pack_range *ranges = malloc(count * sizeof(pack_range));
+    if (!ranges)
+    {
+        return;
+    }
+    size_t ranges_count = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        for (size_t j = 0; j < prefetcher->packs_count; j++)
+        {
+            uint64_t offset = pack_index_find(&prefetcher->packs[j], &oids[i]);
+            if (offset)
+            {
+                ranges[ranges_count].pack = &prefetcher->packs[j];
+                ranges[ranges_count].start = offset;
+                ranges[ranges_count++].end = pack_object_end(&prefetcher->packs[j], offset);
+                break;
+            }
+        }
+    }
+    qsort(ranges, ranges_count, sizeof(pack_range), compare_ranges);
+
+    for (size_t i = 0; i < ranges_count;)
+    {
+        pack_range merged = ranges[i++];
+        while (i < ranges_count && ranges[i].pack == merged.pack && ranges[i].start <= merged.end + PREFETCH_MERGE_GAP)
+        {
+            merged.end = ranges[i].end > merged.end ? ranges[i].end : merged.end;
+            i++;
+        }
+        // fadvise starts async readahead, pread makes sure data is there
+        // also on file systems that ignore the advice
+        posix_fadvise(merged.pack->pack_fd, merged.start, merged.end - merged.start, POSIX_FADV_WILLNEED);
+        for (uint64_t offset = merged.start; offset < merged.end; offset += PREFETCH_READ_CHUNK)
+        {
+            uint64_t length = merged.end - offset < PREFETCH_READ_CHUNK ? merged.end - offset : PREFETCH_READ_CHUNK;
+            if (pread(merged.pack->pack_fd, scratch, length, offset) <= 0)
+            {
+                break;
+            }
+        }
+    }
+    free(ranges);
+}
+
+static void *prefetch_thread(void *arg)
+{
+    prefetcher_t *prefetcher = arg;
+    char *scratch = malloc(PREFETCH_READ_CHUNK);
+    git_oid *batch = NULL;
+    size_t batch_capacity = 0;
+    pthread_mutex_lock(&prefetcher->lock);
+    while (!prefetcher->stop && scratch)
+    {
+        if (prefetcher->pending_count == 0)
+        {
+            pthread_cond_wait(&prefetcher->wake, &prefetcher->lock);
+            continue;
+        }
+        // take all pending requests as one batch
+        size_t count = prefetcher->pending_count;
+        if (count > batch_capacity)
+        {
+            batch_capacity = count;
+            batch = realloc(batch, batch_capacity * sizeof(git_oid));
+        }
+        memcpy(batch, prefetcher->pending, count * sizeof(git_oid));
+        prefetcher->pending_count = 0;
+        pthread_mutex_unlock(&prefetcher->lock);
+
+        prefetch_batch(prefetcher, batch, count, scratch);
+
+        pthread_mutex_lock(&prefetcher->lock);
+        for (size_t i = 0; i < count; i++)
+        {
+            visited_set_add(prefetcher->done, &batch[i]);
+        }
+        prefetcher->prefetched += count;
+    }
+    pthread_mutex_unlock(&prefetcher->lock);
+    free(batch);
+    free(scratch);
+    return NULL;
+}
+
+// Open pack indexes of repository and start prefetch thread,
+// returns NULL if repository has no packs
+prefetcher_t *prefetcher_init(git_repository *repo)
+{
+    char pack_dir[4096];
+    snprintf(pack_dir, sizeof(pack_dir), "%sobjects/pack", git_repository_commondir(repo));
+    DIR *dir = opendir(pack_dir);
+    if (!dir)
+    {
+        return NULL;
+    }
+    prefetcher_t *prefetcher = calloc(1, sizeof(prefetcher_t));
+    if (!prefetcher)
+    {
+        closedir(dir);
+        return NULL;
+    }
+    struct dirent *file;
+    while ((file = readdir(dir)))
+    {
+        size_t length = strlen(file->d_name);
+        if (length < 5 || strcmp(file->d_name + length - 4, ".idx") != 0)
+        {
+            continue;
+        }
+        char idx_path[4096];
+        snprintf(idx_path, sizeof(idx_path), "%s/%s", pack_dir, file->d_name);
+        prefetcher->packs = realloc(prefetcher->packs, (prefetcher->packs_count + 1) * sizeof(pack_index));
+        if (pack_index_open(&prefetcher->packs[prefetcher->packs_count], idx_path) == 0)
+        {
+            prefetcher->packs_count++;
+        }
+    }
+    closedir(dir);
+    if (prefetcher->packs_count == 0)
+    {
+        free(prefetcher->packs);
+        free(prefetcher);
+        return NULL;
+    }
+
+    prefetcher->requested = visited_set_init();
+    prefetcher->done = visited_set_init();
+    pthread_mutex_init(&prefetcher->lock, NULL);
+    pthread_cond_init(&prefetcher->wake, NULL);
+    if (pthread_create(&prefetcher->thread, NULL, prefetch_thread, prefetcher) != 0)
+    {
+        prefetcher->stop = 1;
+        prefetcher_free(prefetcher);
+        return NULL;
+    }
+    return prefetcher;
+}
+
+void prefetcher_free(prefetcher_t *prefetcher)
+{
+    if (!prefetcher)
+    {
+        return;
+    }
+    pthread_mutex_lock(&prefetcher->lock);
+    int running = !prefetcher->stop;
+    prefetcher->stop = 1;
+    pthread_cond_signal(&prefetcher->wake);
+    pthread_mutex_unlock(&prefetcher->lock);
+    if (running)
+    {
+        pthread_join(prefetcher->thread, NULL);
+    }
+    pthread_mutex_destroy(&prefetcher->lock);
+    pthread_cond_destroy(&prefetcher->wake);
+    for (size_t i = 0; i < prefetcher->packs_count; i++)
+    {
+        munmap(prefetcher->packs[i].idx, prefetcher->packs[i].idx_size);
+        close(prefetcher->packs[i].pack_fd);
+    }
+    free(prefetcher->packs);
+    free(prefetcher->pending);
+    visited_set_free(prefetcher->requested);
+    visited_set_free(prefetcher->done);
+    free(prefetcher);
+}
+
+// Queue object for prefetching, objects requested before are ignored
+void prefetcher_request(prefetcher_t *prefetcher, const git_oid *oid)
+{
+    if (!prefetcher)
+    {
+        return;
+    }
+    pthread_mutex_lock(&prefetcher->lock);
+    // long sessions would grow the sets without bound
+    if (prefetcher->requested->size >= PREFETCH_REMEMBER_MAX)
+    {
+        visited_set_free(prefetcher->requested);
+        visited_set_free(prefetcher->done);
+        prefetcher->requested = visited_set_init();
+        prefetcher->done = visited_set_init();
+    }
+    if (!visited_set_contains(prefetcher->requested, oid))
+    {
+        visited_set_add(prefetcher->requested, oid);
+        if (prefetcher->pending_count == prefetcher->pending_capacity)
+        {
+            prefetcher->pending_capacity = prefetcher->pending_capacity ? prefetcher->pending_capacity * 2 : 64;
+            prefetcher->pending = realloc(prefetcher->pending, prefetcher->pending_capacity * sizeof(git_oid));
+            if (!prefetcher->pending)
+            {
+                perror("Failed to reallocate memory for prefetch queue");
+                exit(EXIT_FAILURE);
+            }
+        }
+        git_oid_cpy(&prefetcher->pending[prefetcher->pending_count++], oid);
+        pthread_cond_signal(&prefetcher->wake);
+    }
+    pthread_mutex_unlock(&prefetcher->lock);
+}
+
+// Count object read by search, used for hit rate
+void prefetcher_note_read(prefetcher_t *prefetcher, const git_oid *oid)
+{
+    if (!prefetcher)
+    {
+        return;
+    }
+    pthread_mutex_lock(&prefetcher->lock);
+    prefetcher->reads++;
+    prefetcher->hits += visited_set_contains(prefetcher->done, oid);
+    pthread_mutex_unlock(&prefetcher->lock);
+}
+
+void prefetcher_stats(prefetcher_t *prefetcher, size_t *reads, size_t *hits, size_t *prefetched)
+{
+    *reads = *hits = *prefetched = 0;
+    if (!prefetcher)
+    {
+        return;
+    }
+    pthread_mutex_lock(&prefetcher->lock);
+    *reads = prefetcher->reads;
+    *hits = prefetcher->hits;
+    *prefetched = prefetcher->prefetched;
+    pthread_mutex_unlock(&prefetcher->lock);
+}
@@ -0,0 +1,23 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <git2.h>
+
+/*
+Background prefetch of objects the ancestor search is about to read.
+Requested oids are looked up in pack indexes, sorted by pack offset and
+read in batches on a separate thread so the page cache is warm when
+libgit2 inflates them. The thread reads pack indexes and packs directly,
+the only libgit2 calls it makes are oid compares and copies of the
+visited set of prefetched objects.
+*/
+
+typedef struct prefetcher prefetcher_t;
+
+prefetcher_t *prefetcher_init(git_repository *repo);
+void prefetcher_free(prefetcher_t *prefetcher);
+void prefetcher_request(prefetcher_t *prefetcher, const git_oid *oid);
+void prefetcher_note_read(prefetcher_t *prefetcher, const git_oid *oid);
+void prefetcher_stats(prefetcher_t *prefetcher, size_t *reads, size_t *hits, size_t *prefetched);
+
+#endif
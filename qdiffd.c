@@ -0,0 +1,792 @@
+// struct ucred of SO_PEERCRED
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <limits.h>
+#include <grp.h>
+#include <pwd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <git2.h>
+#include "commit_graph_walk.h"
+#include "cache_client.h"
+#include "timer.h"
+#include "git_tuning.h"
+
+/*
+qdiffd, local daemon shared by qdiff processes. It keeps repositories
+open, resolves file histories once for all clients and keeps inflated
+blobs in shared memory segments clients map read only. Protocol is
+described in cache_client.h. Histories are resolved in slices between
+requests, so clients are answered right away and a client asking for
+history not resolved yet gets MISS and searches in process.
+
+Segments are readable by the daemon user only, clients get them as file
+descriptors passed over the socket. With --shared other users connect
+too, and each request is refused unless the user of the client could
+read the objects of the repository itself.
+*/
+
+#define DAEMON_MAX_CLIENTS 64
+#define DAEMON_MAX_GRAPHS 32
+#define DAEMON_MAX_REPOS 16
+#define DAEMON_LINE_MAX 8192
+#define DAEMON_SLICE_COMMITS 2000
+#define DAEMON_SLICE_MS 20
+#define DAEMON_SEND_TIMEOUT_SEC 2
+#define DAEMON_MAX_GROUPS 64
+
+// Commit-graph file and prefetcher are opened once per repository and
+// shared by all its histories
+typedef struct
+{
+    char *path;
+    git_repository *repo;
+    commit_graph_file_t *graph_file;
+    prefetcher_t *prefetcher;
+} daemon_repo;
+
+// History of one file from one start commit, resolved completely
+typedef struct
+{
+    daemon_repo *repo;
+    git_oid commit;
+    char *path;
+    commit_graph_walk_t *walk;
+    commit_graph_node_t **pending; // nodes whose ancestors are still searched
+    size_t pending_count;
+    size_t pending_capacity;
+    unsigned long used;            // request tick of last use, oldest is evicted
+} daemon_graph;
+
+typedef struct
+{
+    git_oid oid;
+    size_t repo;   // index of repository blob was read from
+    char name[64]; // shared memory segment holding blob content
+    size_t size;
+    unsigned long used;
+} daemon_blob;
+
+typedef struct
+{
+    int fd;
+    uid_t uid; // peer credentials taken when client connected
+    gid_t groups[DAEMON_MAX_GROUPS];
+    int groups_count;
+    char line[DAEMON_LINE_MAX];
+    size_t length;
+} daemon_client;
+
+typedef struct
+{
+    int listen_fd;
+    char socket_path[108];
+    int shared;               // let other users connect, access is checked per request
+    size_t blob_cache_limit;  // bytes of blob segments kept
+    size_t blob_cache_size;
+    daemon_repo *repos;
+    size_t repos_count;
+    daemon_graph *graphs;
+    size_t graphs_count;
+    daemon_blob *blobs;
+    size_t blobs_count;
+    daemon_client clients[DAEMON_MAX_CLIENTS];
+    size_t clients_count;
+    unsigned long tick;
+} daemon_state;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop(int signal)
+{
+    (void)signal;
+    stop_requested = 1;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: qdiffd [--socket PATH] [--blob-cache-mb N] [--shared] [--cache-... | --mwindow-...]\n");
+}
+
+// Write whole buffer, client which can't take answer is dropped later
+static int write_all(int fd, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = send(fd, data, length, MSG_NOSIGNAL);
+        if (written <= 0)
+        {
+            return -1;
+        }
+        data += written;
+        length -= written;
+    }
+    return 0;
+}
+
+// Write answer with file descriptor passed along its first byte
+static int write_with_fd(int fd, const char *data, size_t length, int passed_fd)
+{
+    char control[CMSG_SPACE(sizeof(int))] = {0};
+    struct iovec vector = {(void *)data, 1};
+    struct msghdr message = {0};
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(header), &passed_fd, sizeof(int));
+    if (sendmsg(fd, &message, MSG_NOSIGNAL) != 1)
+    {
+        return -1;
+    }
+    return write_all(fd, data + 1, length - 1);
+}
+
+// Take uid and groups of connected peer, returns 0 on success
+static int daemon_client_credentials(daemon_client *client)
+{
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+    if (getsockopt(client->fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0)
+    {
+        return -1;
+    }
+    client->uid = credentials.uid;
+    // supplementary groups, only the primary one when user is unknown
+    struct passwd entry;
+    struct passwd *user = NULL;
+    char buffer[4096];
+    int count = DAEMON_MAX_GROUPS;
+    if (getpwuid_r(client->uid, &entry, buffer, sizeof(buffer), &user) != 0 || !user ||
+        getgrouplist(user->pw_name, credentials.gid, client->groups, &count) < 0)
+    {
+        client->groups[0] = credentials.gid;
+        count = 1;
+    }
+    client->groups_count = count;
+    return 0;
+}
+
+// Set up client of accepted connection, returns -1 when it is refused
+static int daemon_client_accept(daemon_state *state, daemon_client *client, int fd)
+{
+    client->fd = fd;
+    client->length = 0;
+    if (daemon_client_credentials(client) != 0 || (!state->shared && client->uid != getuid()))
+    {
+        return -1;
+    }
+    // client not reading its answer must not stall the others
+    struct timeval timeout = {DAEMON_SEND_TIMEOUT_SEC, 0};
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    return 0;
+}
+
+// Check permission bits of file for client the way the kernel does for
+// owner, group and others, ACLs are not considered
+static int daemon_client_permitted(const daemon_client *client, const struct stat *info, mode_t wanted)
+{
+    mode_t bits = info->st_mode;
+    if (info->st_uid == client->uid)
+    {
+        bits >>= 6;
+    }
+    else
+    {
+        for (int i = 0; i < client->groups_count; i++)
+        {
+            if (client->groups[i] == info->st_gid)
+            {
+                bits >>= 3;
+                break;
+            }
+        }
+    }
+    return (bits & wanted) == wanted;
+}
+
+// Check that user of client could read objects of repository itself, the
+// objects directory has to be readable and every directory above it
+// searchable. Objects are also read through alternates, which would need
+// the same check for every listed directory, so repositories with them are
+// refused. Clients of the daemon user pass right away.
+static int daemon_client_can_read(const daemon_client *client, git_repository *repo)
+{
+    if (client->uid == getuid() || client->uid == 0)
+    {
+        return 1;
+    }
+    char objects[PATH_MAX];
+    char path[PATH_MAX];
+    struct stat alternates;
+    snprintf(objects, sizeof(objects), "%sobjects", git_repository_commondir(repo));
+    if (!realpath(objects, path))
+    {
+        return 0;
+    }
+    snprintf(objects, sizeof(objects), "%s/info/alternates", path);
+    if (lstat(objects, &alternates) == 0 || errno != ENOENT)
+    {
+        return 0;
+    }
+    mode_t wanted = S_IROTH | S_IXOTH;
+    while (1)
+    {
+        struct stat info;
+        if (stat(*path ? path : "/", &info) != 0 || !daemon_client_permitted(client, &info, wanted))
+        {
+            return 0;
+        }
+        if (!*path)
+        {
+            return 1;
+        }
+        *strrchr(path, '/') = '\0';
+        wanted = S_IXOTH;
+    }
+}
+
+// Find open repository or open it for client, NULL when it can't be opened
+// or client may not read it. New repository is checked before it is kept
+// and gets its commit-graph and prefetch thread, and only
+// DAEMON_MAX_REPOS are kept, further ones are refused.
+static daemon_repo *daemon_repo_open(daemon_state *state, const daemon_client *client, const char *path)
+{
+    for (size_t i = 0; i < state->repos_count; i++)
+    {
+        if (strcmp(state->repos[i].path, path) == 0)
+        {
+            return daemon_client_can_read(client, state->repos[i].repo) ? &state->repos[i] : NULL;
+        }
+    }
+    git_repository *repo = NULL;
+    if (state->repos_count == DAEMON_MAX_REPOS || git_repository_open_ext(&repo, path, 0, NULL) != 0)
+    {
+        return NULL;
+    }
+    if (!daemon_client_can_read(client, repo))
+    {
+        git_repository_free(repo);
+        return NULL;
+    }
+    daemon_repo *repos = realloc(state->repos, (state->repos_count + 1) * sizeof(daemon_repo));
+    if (!repos)
+    {
+        git_repository_free(repo);
+        return NULL;
+    }
+    // graphs point to repos, move them with the array
+    for (size_t i = 0; i < state->graphs_count; i++)
+    {
+        state->graphs[i].repo = repos + (state->graphs[i].repo - state->repos);
+    }
+    state->repos = repos;
+    state->repos[state->repos_count].path = strdup(path);
+    state->repos[state->repos_count].repo = repo;
+    state->repos[state->repos_count].graph_file = commit_graph_file_open(repo);
+    state->repos[state->repos_count].prefetcher = prefetcher_init(repo);
+    return &state->repos[state->repos_count++];
+}
+
+static void daemon_graph_free(daemon_graph *graph)
+{
+    commit_graph_walk_free(graph->walk);
+    free(graph->pending);
+    free(graph->path);
+}
+
+static void daemon_graph_push(daemon_graph *graph, commit_graph_node_t *node)
+{
+    if (graph->pending_count == graph->pending_capacity)
+    {
+        graph->pending_capacity = graph->pending_capacity ? graph->pending_capacity * 2 : 16;
+        graph->pending = realloc(graph->pending, graph->pending_capacity * sizeof(commit_graph_node_t *));
+    }
+    graph->pending[graph->pending_count++] = node;
+}
+
+// Find history or start resolving it, NULL if it can't be resolved
+static daemon_graph *daemon_graph_get(daemon_state *state, daemon_repo *repo, const git_oid *commit_oid, const char *path)
+{
+    state->tick++;
+    for (size_t i = 0; i < state->graphs_count; i++)
+    {
+        daemon_graph *graph = &state->graphs[i];
+        if (graph->repo == repo && git_oid_equal(&graph->commit, commit_oid) && strcmp(graph->path, path) == 0)
+        {
+            graph->used = state->tick;
+            return graph;
+        }
+    }
+
+    git_commit *commit = NULL;
+    git_tree *tree = NULL;
+    int has_entry = git_commit_lookup(&commit, repo->repo, commit_oid) == 0 &&
+                    git_commit_tree(&tree, commit) == 0 &&
+                    git_tree_entry_byname(tree, path) != NULL;
+    git_tree_free(tree);
+    if (!has_entry)
+    {
+        git_commit_free(commit);
+        return NULL;
+    }
+
+    if (state->graphs_count == DAEMON_MAX_GRAPHS)
+    {
+        size_t oldest = 0;
+        for (size_t i = 1; i < state->graphs_count; i++)
+        {
+            if (state->graphs[i].used < state->graphs[oldest].used)
+            {
+                oldest = i;
+            }
+        }
+        daemon_graph_free(&state->graphs[oldest]);
+        state->graphs[oldest] = state->graphs[--state->graphs_count];
+    }
+    else
+    {
+        state->graphs = realloc(state->graphs, (state->graphs_count + 1) * sizeof(daemon_graph));
+    }
+    daemon_graph *graph = &state->graphs[state->graphs_count++];
+    graph->repo = repo;
+    git_oid_cpy(&graph->commit, commit_oid);
+    graph->path = strdup(path);
+    graph->walk = commit_graph_walk_init_shared(commit, path, repo->graph_file, repo->prefetcher);
+    graph->pending = NULL;
+    graph->pending_count = 0;
+    graph->pending_capacity = 0;
+    graph->used = state->tick;
+    daemon_graph_push(graph, graph->walk->current);
+    git_commit_free(commit);
+    return graph;
+}
+
+// Continue resolving pending histories for one slice. Returns 1 while
+// some history is unfinished.
+static int daemon_resolve_step(daemon_state *state)
+{
+    double deadline = timer_now_ms() + DAEMON_SLICE_MS;
+    int pending = 0;
+    for (size_t i = 0; i < state->graphs_count; i++)
+    {
+        daemon_graph *graph = &state->graphs[i];
+        while (graph->pending_count > 0)
+        {
+            double time_left = deadline - timer_now_ms();
+            if (time_left <= 0)
+            {
+                return 1;
+            }
+            commit_graph_node_t *node = graph->pending[graph->pending_count - 1];
+            int result = commit_graph_fetch_ancestors_step(node, DAEMON_SLICE_COMMITS, time_left);
+            if (result == FETCH_IN_PROGRESS)
+            {
+                return 1;
+            }
+            graph->pending_count--;
+            for (size_t j = 0; j < node->ancestor_count; j++)
+            {
+                daemon_graph_push(graph, node->ancestors[j]);
+            }
+        }
+        pending |= graph->pending_count > 0;
+    }
+    return pending;
+}
+
+// Answer resolved history, nodes in breadth first order with index of the
+// node each was found from. Every node comes after that one, which
+// commit_graph_node_add_history relies on.
+static int daemon_send_history(daemon_client *client, daemon_graph *graph)
+{
+    size_t capacity = 64;
+    size_t count = 0;
+    commit_graph_node_t **order = malloc(capacity * sizeof(commit_graph_node_t *));
+    long *descendants = malloc(capacity * sizeof(long));
+    order[count] = graph->walk->current;
+    descendants[count++] = -1;
+    for (size_t i = 0; i < count; i++)
+    {
+        for (size_t j = 0; j < order[i]->ancestor_count; j++)
+        {
+            if (count == capacity)
+            {
+                capacity *= 2;
+                order = realloc(order, capacity * sizeof(commit_graph_node_t *));
+                descendants = realloc(descendants, capacity * sizeof(long));
+            }
+            order[count] = order[i]->ancestors[j];
+            descendants[count++] = i;
+        }
+    }
+
+    size_t size = 32 + count * (2 * GIT_OID_HEXSZ + 24);
+    char *answer = malloc(size);
+    size_t length = snprintf(answer, size, "HISTORY %zu\n", count);
+    for (size_t i = 0; i < count; i++)
+    {
+        char commit[GIT_OID_HEXSZ + 1];
+        char blob[GIT_OID_HEXSZ + 1];
+        git_oid_tostr(commit, sizeof(commit), git_commit_id(order[i]->commit));
+        git_oid_tostr(blob, sizeof(blob), commit_graph_node_blob_id(order[i]));
+        length += snprintf(answer + length, size - length, "%s %ld %s\n", commit, descendants[i], blob);
+    }
+    int result = write_all(client->fd, answer, length);
+    free(answer);
+    free(order);
+    free(descendants);
+    return result;
+}
+
+static void daemon_blob_evict(daemon_state *state)
+{
+    while (state->blob_cache_size > state->blob_cache_limit && state->blobs_count > 1)
+    {
+        size_t oldest = 0;
+        for (size_t i = 1; i < state->blobs_count; i++)
+        {
+            if (state->blobs[i].used < state->blobs[oldest].used)
+            {
+                oldest = i;
+            }
+        }
+        // clients which mapped the segment keep their mapping
+        shm_unlink(state->blobs[oldest].name);
+        state->blob_cache_size -= state->blobs[oldest].size;
+        state->blobs[oldest] = state->blobs[--state->blobs_count];
+    }
+}
+
+// Find blob segment or inflate blob into a new one, NULL on failure
+static daemon_blob *daemon_blob_get(daemon_state *state, daemon_repo *repo, const git_oid *oid)
+{
+    state->tick++;
+    size_t repo_index = repo - state->repos;
+    for (size_t i = 0; i < state->blobs_count; i++)
+    {
+        if (git_oid_equal(&state->blobs[i].oid, oid))
+        {
+            // blob read from other repository is served only if this one has it too
+            git_odb *odb = NULL;
+            int exists = state->blobs[i].repo == repo_index ||
+                         (git_repository_odb(&odb, repo->repo) == 0 && git_odb_exists(odb, oid));
+            git_odb_free(odb);
+            if (!exists)
+            {
+                return NULL;
+            }
+            state->blobs[i].used = state->tick;
+            return &state->blobs[i];
+        }
+    }
+
+    git_blob *blob = NULL;
+    if (git_blob_lookup(&blob, repo->repo, oid) != 0)
+    {
+        return NULL;
+    }
+    daemon_blob entry;
+    git_oid_cpy(&entry.oid, oid);
+    entry.repo = repo_index;
+    snprintf(entry.name, sizeof(entry.name), "/qdiffd-%u-%s", (unsigned)getuid(), git_oid_tostr_s(oid));
+    entry.size = git_blob_rawsize(blob);
+    entry.used = state->tick;
+    // a segment left by previous daemon could be mapped by a client, never truncate it
+    shm_unlink(entry.name);
+    int fd = shm_open(entry.name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    int failed = fd < 0 || ftruncate(fd, entry.size) != 0;
+    if (!failed && entry.size > 0)
+    {
+        void *data = mmap(NULL, entry.size, PROT_WRITE, MAP_SHARED, fd, 0);
+        failed = data == MAP_FAILED;
+        if (!failed)
+        {
+            memcpy(data, git_blob_rawcontent(blob), entry.size);
+            munmap(data, entry.size);
+        }
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    git_blob_free(blob);
+    daemon_blob *blobs = failed ? NULL : realloc(state->blobs, (state->blobs_count + 1) * sizeof(daemon_blob));
+    if (!blobs)
+    {
+        shm_unlink(entry.name);
+        return NULL;
+    }
+    state->blobs = blobs;
+    state->blobs[state->blobs_count++] = entry;
+    state->blob_cache_size += entry.size;
+    daemon_blob_evict(state);
+    // evicting may move entries, new one is the most recently used
+    for (size_t i = 0; i < state->blobs_count; i++)
+    {
+        if (git_oid_equal(&state->blobs[i].oid, oid))
+        {
+            return &state->blobs[i];
+        }
+    }
+    return NULL;
+}
+
+// Split "<repository>\t<oid>[\t<path>]" request arguments, returns number of fields
+static int split_fields(char *arguments, char **fields, int max_fields)
+{
+    int count = 0;
+    while (arguments && count < max_fields)
+    {
+        fields[count++] = arguments;
+        arguments = strchr(arguments, '\t');
+        if (arguments)
+        {
+            *arguments++ = '\0';
+        }
+    }
+    return count;
+}
+
+// Answer one request line, returns -1 when client should be dropped
+static int daemon_handle_request(daemon_state *state, daemon_client *client, char *line)
+{
+    char *fields[3];
+    git_oid oid;
+    daemon_repo *repo;
+    char answer[128];
+    if (strncmp(line, "HISTORY ", 8) == 0 && split_fields(line + 8, fields, 3) == 3 &&
+        git_oid_fromstrn(&oid, fields[1], strlen(fields[1])) == 0 && (repo = daemon_repo_open(state, client, fields[0])))
+    {
+        daemon_graph *graph = daemon_graph_get(state, repo, &oid, fields[2]);
+        if (!graph)
+        {
+            return write_all(client->fd, "ERROR\n", 6);
+        }
+        if (graph->pending_count > 0)
+        {
+            return write_all(client->fd, "MISS\n", 5);
+        }
+        return daemon_send_history(client, graph);
+    }
+    if (strncmp(line, "BLOB ", 5) == 0 && split_fields(line + 5, fields, 2) == 2 &&
+        git_oid_fromstrn(&oid, fields[1], strlen(fields[1])) == 0 && (repo = daemon_repo_open(state, client, fields[0])))
+    {
+        daemon_blob *blob = daemon_blob_get(state, repo, &oid);
+        int fd = blob ? shm_open(blob->name, O_RDONLY, 0) : -1;
+        if (fd < 0)
+        {
+            return write_all(client->fd, "ERROR\n", 6);
+        }
+        int length = snprintf(answer, sizeof(answer), "FD %zu\n", blob->size);
+        int result = write_with_fd(client->fd, answer, length, fd);
+        close(fd);
+        return result;
+    }
+    return write_all(client->fd, "ERROR\n", 6);
+}
+
+// Read available input of client and answer complete lines, returns -1
+// when client disconnected or misbehaved
+static int daemon_client_read(daemon_state *state, daemon_client *client)
+{
+    ssize_t received = recv(client->fd, client->line + client->length, sizeof(client->line) - client->length - 1, 0);
+    if (received <= 0)
+    {
+        return -1;
+    }
+    client->length += received;
+    client->line[client->length] = '\0';
+    char *start = client->line;
+    char *end;
+    while ((end = strchr(start, '\n')))
+    {
+        *end = '\0';
+        if (daemon_handle_request(state, client, start) != 0)
+        {
+            return -1;
+        }
+        start = end + 1;
+    }
+    client->length -= start - client->line;
+    memmove(client->line, start, client->length);
+    // request longer than line buffer
+    return client->length == sizeof(client->line) - 1 ? -1 : 0;
+}
+
+// Bind listening socket, refuses to start when another daemon answers
+static int daemon_listen(daemon_state *state)
+{
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", state->socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0)
+    {
+        fprintf(stderr, "qdiffd: already running on %s\n", state->socket_path);
+        close(fd);
+        return -1;
+    }
+    // stale socket of a daemon which didn't exit cleanly
+    unlink(state->socket_path);
+    // any user may connect to shared daemon, requests are checked
+    mode_t mask = umask(state->shared ? 0 : 0077);
+    int failed = bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, 16) != 0;
+    umask(mask);
+    if (failed)
+    {
+        perror("qdiffd: cannot listen");
+        close(fd);
+        return -1;
+    }
+    state->listen_fd = fd;
+    return 0;
+}
+
+static void daemon_free(daemon_state *state)
+{
+    for (size_t i = 0; i < state->clients_count; i++)
+    {
+        close(state->clients[i].fd);
+    }
+    for (size_t i = 0; i < state->blobs_count; i++)
+    {
+        shm_unlink(state->blobs[i].name);
+    }
+    for (size_t i = 0; i < state->graphs_count; i++)
+    {
+        daemon_graph_free(&state->graphs[i]);
+    }
+    // graphs are freed first, their walks use these
+    for (size_t i = 0; i < state->repos_count; i++)
+    {
+        prefetcher_free(state->repos[i].prefetcher);
+        commit_graph_file_free(state->repos[i].graph_file);
+        git_repository_free(state->repos[i].repo);
+        free(state->repos[i].path);
+    }
+    free(state->blobs);
+    free(state->graphs);
+    free(state->repos);
+    close(state->listen_fd);
+    unlink(state->socket_path);
+}
+
+int main(int argc, char *argv[])
+{
+    static daemon_state state;
+    state.blob_cache_limit = (size_t)256 << 20;
+    cache_socket_path(state.socket_path, sizeof(state.socket_path));
+    git_tuning_t tuning = {0};
+    char config_path[4096];
+    git_tuning_config_path(config_path, sizeof(config_path));
+    git_tuning_load(&tuning, config_path);
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+        {
+            snprintf(state.socket_path, sizeof(state.socket_path), "%s", argv[++i]);
+        }
+        else if (strcmp(argv[i], "--blob-cache-mb") == 0 && i + 1 < argc)
+        {
+            state.blob_cache_limit = (size_t)atol(argv[++i]) << 20;
+        }
+        else if (strcmp(argv[i], "--shared") == 0)
+        {
+            state.shared = 1;
+        }
+        else if (git_tuning_is_flag(argv[i]))
+        {
+            if (git_tuning_flag(&tuning, argc, argv, &i) != 0)
+            {
+                usage();
+                return 1;
+            }
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    git_libgit2_init();
+    // settings are global while repositories come and go, so auto mode
+    // sizes from available memory only
+    git_tuning_auto(&tuning, NULL);
+    git_tuning_apply(&tuning);
+    if (daemon_listen(&state) != 0)
+    {
+        git_libgit2_shutdown();
+        return 1;
+    }
+    struct sigaction action = {0};
+    action.sa_handler = handle_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    fprintf(stderr, "qdiffd: listening on %s\n", state.socket_path);
+
+    int resolving = 0;
+    while (!stop_requested)
+    {
+        struct pollfd fds[DAEMON_MAX_CLIENTS + 1];
+        fds[0].fd = state.listen_fd;
+        fds[0].events = POLLIN;
+        for (size_t i = 0; i < state.clients_count; i++)
+        {
+            fds[i + 1].fd = state.clients[i].fd;
+            fds[i + 1].events = POLLIN;
+        }
+        // histories are resolved whenever no request waits
+        int ready = poll(fds, state.clients_count + 1, resolving ? 0 : -1);
+        if (ready < 0 && errno != EINTR)
+        {
+            perror("qdiffd: poll");
+            break;
+        }
+        for (size_t i = state.clients_count; ready > 0 && i > 0; i--)
+        {
+            if (fds[i].revents && daemon_client_read(&state, &state.clients[i - 1]) != 0)
+            {
+                close(state.clients[i - 1].fd);
+                state.clients[i - 1] = state.clients[--state.clients_count];
+            }
+        }
+        if (ready > 0 && (fds[0].revents & POLLIN))
+        {
+            int fd = accept(state.listen_fd, NULL, NULL);
+            if (fd >= 0 && state.clients_count < DAEMON_MAX_CLIENTS &&
+                daemon_client_accept(&state, &state.clients[state.clients_count], fd) == 0)
+            {
+                state.clients_count++;
+            }
+            else if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+        resolving = daemon_resolve_step(&state);
+    }
+
+    daemon_free(&state);
+    git_libgit2_shutdown();
+    return 0;
+}
@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+#include <git2.h>
+#include <ncurses.h>
+#include "app.h"
+#include "timer.h"
+#include "syntax.h"
+#include "line_store.h"
+#include "git_tuning.h"
+
+/*
+Replays recorded key sequence against a repository on the headless
+backend and reports latency of handling each key and how many
+allocations it made. Search work between keys runs to completion and is
+not counted, like in the interactive app where it happens while the user
+is not typing. Only allocations of the main thread, which handles keys,
+are counted, the prefetch thread allocates meanwhile on its own.
+*/
+
+#ifdef __GLIBC__
+// Count allocations, libgit2 and ncurses included, by interposing glibc
+// allocator entry points. Counter is per thread, so other threads neither
+// race on it nor show up in the main thread's count.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static _Thread_local size_t allocations = 0;
+
+void *malloc(size_t size)
+{
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    allocations++;
+    return __libc_realloc(ptr, size);
+}
+#else
+static size_t allocations = 0;
+#endif
+
+typedef struct
+{
+    int key;
+    double latency_ms;
+    size_t allocations;
+} key_sample;
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Nearest rank percentile of sorted values
+static double percentile(const double *sorted, size_t count, double p)
+{
+    size_t rank = (size_t)(p / 100.0 * count + 0.5);
+    rank = rank < 1 ? 1 : (rank > count ? count : rank);
+    return sorted[rank - 1];
+}
+
+// Print percentiles of samples with given key, 0 means all keys
+static void report(const key_sample *samples, size_t count, int key)
+{
+    double *latencies = malloc(count * sizeof(double));
+    size_t selected = 0;
+    size_t allocations_total = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (key == 0 || samples[i].key == key)
+        {
+            latencies[selected++] = samples[i].latency_ms;
+            allocations_total += samples[i].allocations;
+        }
+    }
+    if (selected > 0)
+    {
+        qsort(latencies, selected, sizeof(double), compare_doubles);
+        char name[16];
+        if (key == 0)
+        {
+            snprintf(name, sizeof(name), "all");
+        }
+        else
+        {
+            snprintf(name, sizeof(name), key < 256 && key > ' ' ? "'%c'" : "%d", key);
+        }
+        printf("%-6s %6zu keys  p50 %8.3f ms  p99 %8.3f ms  max %8.3f ms  %8.1f allocs/key\n", name, selected,
+               percentile(latencies, selected, 50), percentile(latencies, selected, 99), latencies[selected - 1],
+               (double)allocations_total / selected);
+    }
+    free(latencies);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: qdiff_replay [--size COLSxLINES] [--repeat N] [--cache-... | --mwindow-...] <filepath> <keys>\n");
+    fprintf(stderr, "libgit2 cache settings are read from qdiff config file and flags like in qdiff.\n");
+    fprintf(stderr, "Keys are replayed one character at a time, 'q' stops the replay.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int repeat = 1;
+    int columns = 160;
+    int lines = 48;
+    char *filepath = NULL;
+    const char *keys = NULL;
+    git_tuning_t tuning = {0};
+    char config_path[4096];
+    git_tuning_config_path(config_path, sizeof(config_path));
+    git_tuning_load(&tuning, config_path);
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+        {
+            repeat = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+        {
+            sscanf(argv[++i], "%dx%d", &columns, &lines);
+        }
+        else if (git_tuning_is_flag(argv[i]))
+        {
+            if (git_tuning_flag(&tuning, argc, argv, &i) != 0)
+            {
+                return 1;
+            }
+        }
+        else if (!filepath)
+        {
+            filepath = argv[i];
+        }
+        else
+        {
+            keys = argv[i];
+        }
+    }
+    if (!filepath || !keys || repeat < 1)
+    {
+        usage();
+        return 1;
+    }
+    const char *filename = basename(filepath);
+
+    git_libgit2_init();
+    git_repository *repo = NULL;
+    git_commit *head_commit = NULL;
+    git_oid commit_oid;
+    if (git_repository_open_ext(&repo, filepath, 0, NULL) != 0 ||
+        git_reference_name_to_id(&commit_oid, repo, "HEAD") != 0 ||
+        git_commit_lookup(&head_commit, repo, &commit_oid) != 0)
+    {
+        const git_error *e = git_error_last();
+        fprintf(stderr, "Error: %s\n", e ? e->message : "cannot open repository");
+        return 1;
+    }
+
+    git_tuning_auto(&tuning, repo);
+    git_tuning_apply(&tuning);
+
+    size_t keys_length = strlen(keys);
+    int *key_codes = malloc(keys_length * sizeof(int));
+    for (size_t i = 0; i < keys_length; i++)
+    {
+        key_codes[i] = (unsigned char)keys[i];
+    }
+    for (int i = 0; i < repeat; i++)
+    {
+        headless_backend_feed(key_codes, keys_length);
+    }
+
+    headless_backend_set_size(columns, lines);
+    double start = timer_now_ms();
+    app_t *app = app_init(&headless_backend, head_commit, filepath, filename);
+    git_commit_free(head_commit);
+    double first_paint = timer_now_ms() - start;
+    while (app_idle(app))
+        ;
+    double history = timer_now_ms() - start;
+
+    key_sample *samples = malloc(keys_length * repeat * sizeof(key_sample));
+    size_t samples_count = 0;
+    int key;
+    while ((key = headless_backend.read_key(0)) != ERR)
+    {
+        size_t allocations_before = allocations;
+        double key_start = timer_now_ms();
+        int running = app_handle_key(app, key);
+        samples[samples_count].latency_ms = timer_now_ms() - key_start;
+        samples[samples_count].allocations = allocations - allocations_before;
+        samples[samples_count++].key = key;
+        if (!running)
+        {
+            break;
+        }
+        while (app_idle(app))
+            ;
+    }
+    app_free(app);
+
+    char settings[256];
+    git_tuning_format(&tuning, settings, sizeof(settings));
+    printf("%s\n", settings);
+    printf("first paint %.3f ms, root history resolved %.3f ms\n", first_paint, history);
+    report(samples, samples_count, 0);
+    for (size_t i = 0; i < keys_length; i++)
+    {
+        if (!memchr(keys, keys[i], i))
+        {
+            report(samples, samples_count, (unsigned char)keys[i]);
+        }
+    }
+#ifndef __GLIBC__
+    printf("allocation counting needs glibc, allocs/key are not measured\n");
+#endif
+
+    free(samples);
+    free(key_codes);
+    syntax_cache_free();
+    line_store_free();
+    git_repository_free(repo);
+    git_libgit2_shutdown();
+    return 0;
+}
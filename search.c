@@ -0,0 +1,141 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "search.h"
+
+void file_search_init(file_search *search)
+{
+    search->query[0] = '\0';
+    search->query_length = 0;
+    search->matches = NULL;
+    search->matches_count = 0;
+    search->matches_capacity = 0;
+    search->current = -1;
+    search->dirty = 0;
+}
+
+void file_search_free(file_search *search)
+{
+    free(search->matches);
+    file_search_init(search);
+}
+
+void file_search_set_query(file_search *search, const char *query)
+{
+    snprintf(search->query, sizeof(search->query), "%s", query);
+    search->query_length = strlen(search->query);
+    search->dirty = 1;
+}
+
+static void add_match(file_search *search, int line, int column)
+{
+    if (search->matches_count == search->matches_capacity)
+    {
+        search->matches_capacity = search->matches_capacity ? search->matches_capacity * 2 : 64;
+        search->matches = realloc(search->matches, search->matches_capacity * sizeof(search_match));
+        if (!search->matches)
+        {
+            perror("Failed to reallocate memory for search matches");
+            exit(EXIT_FAILURE);
+        }
+    }
+    search->matches[search->matches_count].line = line;
+    search->matches[search->matches_count++].column = column;
+}
+
+/*
+Build sorted index of all matches in buffer. Candidates are found with
+memchr on first query byte, which libc implements with vector instructions,
+and only those are compared with whole query. Lines are scanned in order
+so matches come out sorted.
+*/
+void file_search_index(file_search *search, line_data **buffer, int lines_count)
+{
+    search->matches_count = 0;
+    search->current = -1;
+    search->dirty = 0;
+    if (search->query_length == 0)
+    {
+        return;
+    }
+    char first = search->query[0];
+    for (int i = 0; i < lines_count; i++)
+    {
+        const char *text = buffer[i]->text;
+        int length = buffer[i]->length;
+        const char *candidate = text;
+        while ((candidate = memchr(candidate, first, text + length - candidate)))
+        {
+            if (text + length - candidate < search->query_length)
+            {
+                break;
+            }
+            if (memcmp(candidate, search->query, search->query_length) == 0)
+            {
+                add_match(search, i, candidate - text);
+                candidate += search->query_length;
+            }
+            else
+            {
+                candidate++;
+            }
+        }
+    }
+}
+
+// Compare match position with (line, column)
+static int match_compare(const search_match *match, int line, int column)
+{
+    if (match->line != line)
+    {
+        return match->line < line ? -1 : 1;
+    }
+    return match->column < column ? -1 : (match->column > column ? 1 : 0);
+}
+
+// Index of first match after (line, column), matches_count if none
+static int first_after(file_search *search, int line, int column)
+{
+    int low = 0;
+    int high = search->matches_count;
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        if (match_compare(&search->matches[middle], line, column) <= 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Index of first match in line or later, used to highlight matches while printing
+int file_search_first_in_line(file_search *search, int line)
+{
+    return first_after(search, line, -1);
+}
+
+// Next (direction > 0) or previous match from (line, column), wraps around
+// end of buffer. Returns match index or -1 if there are no matches.
+int file_search_find(file_search *search, int line, int column, int direction)
+{
+    if (search->matches_count == 0)
+    {
+        return -1;
+    }
+    int index = first_after(search, line, column);
+    if (direction > 0)
+    {
+        return index < search->matches_count ? index : 0;
+    }
+    // step back over matches at (line, column) itself
+    while (index > 0 && match_compare(&search->matches[index - 1], line, column) >= 0)
+    {
+        index--;
+    }
+    return index > 0 ? index - 1 : search->matches_count - 1;
+}
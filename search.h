@@ -0,0 +1,13 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "windows.h"
+
+void file_search_init(file_search *search);
+void file_search_free(file_search *search);
+void file_search_set_query(file_search *search, const char *query);
+void file_search_index(file_search *search, line_data **buffer, int lines_count);
+int file_search_first_in_line(file_search *search, int line);
+int file_search_find(file_search *search, int line, int column, int direction);
+
+#endif
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <git2.h>
+#include "stats.h"
+
+stats_t stats;
+
+// Human readable byte count, 1536 -> 1.5 KiB
+static void format_bytes(char *out, size_t size, double bytes)
+{
+    const char *units[] = {"B", "KiB", "MiB", "GiB"};
+    int unit = 0;
+    while (bytes >= 1024 && unit < 3)
+    {
+        bytes /= 1024;
+        unit++;
+    }
+    snprintf(out, size, unit ? "%.1f %s" : "%.0f %s", bytes, units[unit]);
+}
+
+// Format current counters as text lines, shared by stats panel and stderr
+// dump. Returns number of lines written.
+size_t stats_format(char lines[][STATS_LINE_MAX], size_t max_lines)
+{
+    char held[3][32];
+    ssize_t cached = 0;
+    ssize_t cache_limit = 0;
+    git_libgit2_opts(GIT_OPT_GET_CACHED_MEMORY, &cached, &cache_limit);
+    format_bytes(held[0], sizeof(held[0]), cached);
+    format_bytes(held[1], sizeof(held[1]), cache_limit);
+    format_bytes(held[2], sizeof(held[2]), stats.virtual_bytes);
+
+    size_t count = 0;
+    if (count < max_lines)
+    {
+        snprintf(lines[count++], STATS_LINE_MAX, "graph: %zu nodes, %zu commits, %s uncommitted",
+                 stats.nodes, stats.node_commits, held[2]);
+    }
+    format_bytes(held[2], sizeof(held[2]), stats.visited_bytes);
+    if (count < max_lines)
+    {
+        snprintf(lines[count++], STATS_LINE_MAX, "search: %zu visited sets, %zu oids, %s, %zu commits on stack",
+                 stats.visited_sets, stats.visited_oids, held[2], stats.search_commits);
+    }
+    format_bytes(held[2], sizeof(held[2]), stats.line_bytes);
+    if (count < max_lines)
+    {
+        snprintf(lines[count++], STATS_LINE_MAX, "buffers: %zu lines, line store %s", stats.lines, held[2]);
+    }
+    if (count < max_lines)
+    {
+        snprintf(lines[count++], STATS_LINE_MAX, "libgit2 cache: %s of %s", held[0], held[1]);
+    }
+    if (count < max_lines)
+    {
+        snprintf(lines[count++], STATS_LINE_MAX, "time: search %.1f ms (%zu slices)", stats.search_ms, stats.search_slices);
+    }
+    if (count < max_lines)
+    {
+        snprintf(lines[count++], STATS_LINE_MAX, "      blob load %.1f ms (%zu loads), diff %.1f ms (%zu diffs)",
+                 stats.blob_load_ms, stats.blob_loads, stats.diff_ms, stats.diffs);
+    }
+    return count;
+}
@@ -0,0 +1,39 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+
+/*
+Counters of what qdiff holds in memory and where its time goes. They are
+plain globals updated where objects are created and freed, cheap enough
+to stay compiled in, and are shown in the stats panel and dumped to
+stderr on exit with --stats.
+*/
+typedef struct
+{
+    size_t nodes;          // live commit_graph_node_t
+    size_t node_commits;   // git_commit objects held by nodes
+    size_t search_commits; // git_commit objects held by search frames
+    size_t virtual_bytes;  // content of index and working tree nodes
+    // visited sets are used by prefetch thread too, so these are atomic
+    _Atomic size_t visited_sets;  // live visited sets of searches and prefetcher
+    _Atomic size_t visited_oids;  // oids in them
+    _Atomic size_t visited_bytes; // bytes of their slots
+    size_t lines;          // live line_data of displays
+    size_t line_bytes;     // bytes of blobs in shared line store
+    double search_ms;      // ancestor search, including goto and daemon history
+    size_t search_slices;
+    double blob_load_ms;   // loading blobs into display buffers
+    size_t blob_loads;
+    double diff_ms;        // diffs between displays
+    size_t diffs;
+} stats_t;
+
+#define STATS_LINE_MAX 80
+#define STATS_LINES 8
+
+extern stats_t stats;
+
+size_t stats_format(char lines[][STATS_LINE_MAX], size_t max_lines);
+
+#endif
@@ -0,0 +1,291 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "syntax.h"
+
+static const char *const c_extensions[] = {"c", "h", "cc", "cpp", "cxx", "hh", "hpp", "hxx", NULL};
+static const char *const c_keywords[] = {
+    "auto", "bool", "break", "case", "char", "class", "const", "constexpr", "continue", "default",
+    "delete", "do", "double", "else", "enum", "extern", "false", "float", "for", "goto", "if",
+    "inline", "int", "long", "namespace", "new", "nullptr", "private", "protected", "public",
+    "register", "return", "short", "signed", "sizeof", "static", "struct", "switch", "template",
+    "this", "true", "typedef", "typename", "union", "unsigned", "using", "virtual", "void",
+    "volatile", "while", "#include", "#define", "#ifdef", "#ifndef", "#endif", "#if", "#else", NULL};
+
+static const char *const python_extensions[] = {"py", NULL};
+static const char *const python_keywords[] = {
+    "False", "None", "True", "and", "as", "assert", "async", "await", "break", "class", "continue",
+    "def", "del", "elif", "else", "except", "finally", "for", "from", "global", "if", "import",
+    "in", "is", "lambda", "nonlocal", "not", "or", "pass", "raise", "return", "try", "while",
+    "with", "yield", NULL};
+
+static const char *const shell_extensions[] = {"sh", "bash", "zsh", NULL};
+static const char *const shell_keywords[] = {
+    "if", "then", "else", "elif", "fi", "for", "while", "until", "do", "done", "case", "esac",
+    "in", "function", "return", "local", "export", "echo", NULL};
+
+static const char *const js_extensions[] = {"js", "jsx", "ts", "tsx", "mjs", NULL};
+static const char *const js_keywords[] = {
+    "async", "await", "break", "case", "catch", "class", "const", "continue", "default", "delete",
+    "do", "else", "export", "extends", "false", "finally", "for", "function", "if", "import", "in",
+    "instanceof", "let", "new", "null", "return", "switch", "this", "throw", "true", "try",
+    "typeof", "undefined", "var", "void", "while", "yield", NULL};
+
+static const char *const rust_extensions[] = {"rs", NULL};
+static const char *const rust_keywords[] = {
+    "as", "break", "const", "continue", "crate", "else", "enum", "extern", "false", "fn", "for",
+    "if", "impl", "in", "let", "loop", "match", "mod", "move", "mut", "pub", "ref", "return",
+    "self", "Self", "static", "struct", "super", "trait", "true", "type", "unsafe", "use",
+    "where", "while", NULL};
+
+static const char *const go_extensions[] = {"go", NULL};
+static const char *const go_keywords[] = {
+    "break", "case", "chan", "const", "continue", "default", "defer", "else", "fallthrough",
+    "for", "func", "go", "goto", "if", "import", "interface", "map", "nil", "package", "range",
+    "return", "select", "struct", "switch", "type", "var", NULL};
+
+static const syntax_language languages[] = {
+    {"C", c_extensions, "//", "/*", "*/", NULL, "\"'", c_keywords},
+    {"Python", python_extensions, "#", NULL, NULL, "\"\"\"", "\"'", python_keywords},
+    {"Shell", shell_extensions, "#", NULL, NULL, NULL, "\"'", shell_keywords},
+    {"JavaScript", js_extensions, "//", "/*", "*/", "`", "\"'", js_keywords},
+    {"Rust", rust_extensions, "//", "/*", "*/", NULL, "\"", rust_keywords},
+    {"Go", go_extensions, "//", "/*", "*/", "`", "\"'", go_keywords},
+};
+
+static syntax_cache_entry cache[SYNTAX_CACHE_SIZE];
+static int cache_used = 0;
+static int cache_next = 0; // slot replaced when cache is full
+
+// Find language by file extension, NULL if file should not be highlighted
+const syntax_language *syntax_language_for(const char *filename)
+{
+    const char *extension = filename ? strrchr(filename, '.') : NULL;
+    if (!extension)
+    {
+        return NULL;
+    }
+    extension++;
+    for (size_t i = 0; i < sizeof(languages) / sizeof(languages[0]); i++)
+    {
+        for (int j = 0; languages[i].extensions[j]; j++)
+        {
+            if (strcmp(languages[i].extensions[j], extension) == 0)
+            {
+                return &languages[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+// Get checkpoints of blob, blobs already seen keep their checkpoints
+// so switching back to them needs no tokenizing
+syntax_cache_entry *syntax_cache_get(const git_oid *blob_id, const syntax_language *language)
+{
+    for (int i = 0; i < cache_used; i++)
+    {
+        if (cache[i].language == language && git_oid_equal(&cache[i].blob_id, blob_id))
+        {
+            return &cache[i];
+        }
+    }
+    syntax_cache_entry *entry;
+    if (cache_used < SYNTAX_CACHE_SIZE)
+    {
+        entry = &cache[cache_used++];
+        entry->checkpoints = NULL;
+    }
+    else
+    {
+        entry = &cache[cache_next];
+        cache_next = (cache_next + 1) % SYNTAX_CACHE_SIZE;
+    }
+    git_oid_cpy(&entry->blob_id, blob_id);
+    entry->language = language;
+    entry->checkpoints_capacity = 16;
+    entry->checkpoints = realloc(entry->checkpoints, entry->checkpoints_capacity);
+    if (!entry->checkpoints)
+    {
+        perror("Failed to allocate memory for syntax checkpoints");
+        exit(EXIT_FAILURE);
+    }
+    // first line always starts in normal state
+    entry->checkpoints[0] = SYNTAX_STATE_NORMAL;
+    entry->checkpoints_count = 1;
+    return entry;
+}
+
+void syntax_cache_free(void)
+{
+    for (int i = 0; i < cache_used; i++)
+    {
+        free(cache[i].checkpoints);
+    }
+    cache_used = 0;
+    cache_next = 0;
+}
+
+static int starts_with(const char *text, int length, const char *prefix)
+{
+    int prefix_length = strlen(prefix);
+    return prefix_length <= length && strncmp(text, prefix, prefix_length) == 0;
+}
+
+static int is_keyword(const syntax_language *language, const char *text, int length)
+{
+    for (int i = 0; language->keywords[i]; i++)
+    {
+        if ((int)strlen(language->keywords[i]) == length && strncmp(language->keywords[i], text, length) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Skip to end of text or past closing delimiter, returns 1 if delimiter was found
+static int skip_to(const char *text, int length, int *i, const char *delimiter)
+{
+    int delimiter_length = strlen(delimiter);
+    for (; *i < length; (*i)++)
+    {
+        if (starts_with(text + *i, length - *i, delimiter))
+        {
+            *i += delimiter_length;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void mark(unsigned char *tokens, int from, int to, int token)
+{
+    if (tokens)
+    {
+        memset(tokens + from, token, to - from);
+    }
+}
+
+/*
+Tokenize one line starting in given state, returns state at start of next line.
+Token class of every byte is written to tokens, if tokens is NULL only
+state is tracked which is what checkpoints need.
+*/
+int syntax_tokenize_line(const syntax_language *language, int state, const char *text, int length, unsigned char *tokens)
+{
+    if (length > 0 && text[length - 1] == '\n')
+    {
+        length--;
+    }
+    mark(tokens, 0, length, TOKEN_NORMAL);
+    int i = 0;
+    while (i < length)
+    {
+        int start = i;
+        const char *rest = text + i;
+        int rest_length = length - i;
+        if (state == SYNTAX_STATE_BLOCK_COMMENT)
+        {
+            if (skip_to(text, length, &i, language->block_comment_end))
+            {
+                state = SYNTAX_STATE_NORMAL;
+            }
+            mark(tokens, start, i, TOKEN_COMMENT);
+        }
+        else if (state == SYNTAX_STATE_BLOCK_STRING)
+        {
+            if (skip_to(text, length, &i, language->block_string))
+            {
+                state = SYNTAX_STATE_NORMAL;
+            }
+            mark(tokens, start, i, TOKEN_STRING);
+        }
+        else if (language->line_comment && starts_with(rest, rest_length, language->line_comment))
+        {
+            mark(tokens, start, length, TOKEN_COMMENT);
+            break;
+        }
+        else if (language->block_comment_start && starts_with(rest, rest_length, language->block_comment_start))
+        {
+            i += strlen(language->block_comment_start);
+            state = SYNTAX_STATE_BLOCK_COMMENT;
+            mark(tokens, start, i, TOKEN_COMMENT);
+        }
+        else if (language->block_string && starts_with(rest, rest_length, language->block_string))
+        {
+            i += strlen(language->block_string);
+            state = SYNTAX_STATE_BLOCK_STRING;
+            mark(tokens, start, i, TOKEN_STRING);
+        }
+        else if (text[i] && strchr(language->quotes, text[i]))
+        {
+            char quote = text[i++];
+            while (i < length && text[i] != quote)
+            {
+                i += text[i] == '\\' ? 2 : 1;
+            }
+            i = i < length ? i + 1 : length;
+            mark(tokens, start, i, TOKEN_STRING);
+        }
+        else if (isdigit((unsigned char)text[i]))
+        {
+            while (i < length && (isalnum((unsigned char)text[i]) || text[i] == '.' || text[i] == '_'))
+            {
+                i++;
+            }
+            mark(tokens, start, i, TOKEN_NUMBER);
+        }
+        else if (isalpha((unsigned char)text[i]) || text[i] == '_' || text[i] == '#')
+        {
+            i++;
+            while (i < length && (isalnum((unsigned char)text[i]) || text[i] == '_'))
+            {
+                i++;
+            }
+            if (tokens && is_keyword(language, text + start, i - start))
+            {
+                mark(tokens, start, i, TOKEN_KEYWORD);
+            }
+        }
+        else
+        {
+            i++;
+        }
+    }
+    return state;
+}
+
+// State at start of line, tokenizing forward from nearest checkpoint.
+// Missing checkpoints up to that line are computed and kept in entry.
+int syntax_state_at(syntax_cache_entry *entry, line_data **buffer, int lines_count, int line)
+{
+    int checkpoint = line / SYNTAX_CHECKPOINT_LINES;
+    while (entry->checkpoints_count <= checkpoint)
+    {
+        int state = entry->checkpoints[entry->checkpoints_count - 1];
+        int from = (entry->checkpoints_count - 1) * SYNTAX_CHECKPOINT_LINES;
+        for (int i = from; i < from + SYNTAX_CHECKPOINT_LINES && i < lines_count; i++)
+        {
+            state = syntax_tokenize_line(entry->language, state, buffer[i]->text, buffer[i]->length, NULL);
+        }
+        if (entry->checkpoints_count == entry->checkpoints_capacity)
+        {
+            entry->checkpoints_capacity *= 2;
+            entry->checkpoints = realloc(entry->checkpoints, entry->checkpoints_capacity);
+            if (!entry->checkpoints)
+            {
+                perror("Failed to reallocate memory for syntax checkpoints");
+                exit(EXIT_FAILURE);
+            }
+        }
+        entry->checkpoints[entry->checkpoints_count++] = state;
+    }
+    int state = entry->checkpoints[checkpoint];
+    for (int i = checkpoint * SYNTAX_CHECKPOINT_LINES; i < line && i < lines_count; i++)
+    {
+        state = syntax_tokenize_line(entry->language, state, buffer[i]->text, buffer[i]->length, NULL);
+    }
+    return state;
+}
@@ -0,0 +1,52 @@
+#ifndef SYNTAX_H
+#define SYNTAX_H
+
+#include <git2.h>
+#include "windows.h"
+
+// Token classes of tokenized line
+#define TOKEN_NORMAL 0
+#define TOKEN_KEYWORD 1
+#define TOKEN_COMMENT 2
+#define TOKEN_STRING 3
+#define TOKEN_NUMBER 4
+
+// Tokenizer states carried from one line to the next
+#define SYNTAX_STATE_NORMAL 0
+#define SYNTAX_STATE_BLOCK_COMMENT 1
+#define SYNTAX_STATE_BLOCK_STRING 2
+
+// Tokenizer state is saved at start of every SYNTAX_CHECKPOINT_LINES line
+#define SYNTAX_CHECKPOINT_LINES 64
+// Number of blobs with cached checkpoints
+#define SYNTAX_CACHE_SIZE 32
+
+typedef struct
+{
+    const char *name;
+    const char *const *extensions; // NULL terminated
+    const char *line_comment;      // NULL if language has none
+    const char *block_comment_start;
+    const char *block_comment_end;
+    const char *block_string;      // delimiter of strings spanning lines, NULL if none
+    const char *quotes;            // characters starting single line strings
+    const char *const *keywords;   // NULL terminated
+} syntax_language;
+
+// Checkpoints of one blob, tokenizer can start from any of them
+typedef struct
+{
+    git_oid blob_id;
+    const syntax_language *language;
+    unsigned char *checkpoints; // state at start of line i * SYNTAX_CHECKPOINT_LINES
+    int checkpoints_count;      // number of checkpoints computed so far
+    int checkpoints_capacity;
+} syntax_cache_entry;
+
+const syntax_language *syntax_language_for(const char *filename);
+syntax_cache_entry *syntax_cache_get(const git_oid *blob_id, const syntax_language *language);
+void syntax_cache_free(void);
+int syntax_tokenize_line(const syntax_language *language, int state, const char *text, int length, unsigned char *tokens);
+int syntax_state_at(syntax_cache_entry *entry, line_data **buffer, int lines_count, int line);
+
+#endif
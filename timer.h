@@ -0,0 +1,7 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+// Milliseconds from an arbitrary fixed point, only differences are meaningful
+double timer_now_ms(void);
+
+#endif
@@ -0,0 +1,59 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/inotify.h>
+#include "watch.h"
+
+// Start watching directory of path, returns non blocking inotify
+// descriptor or -1 when watching is not possible
+int file_watch_init(const char *path)
+{
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    char *copy = strdup(path);
+    int watch = copy ? inotify_add_watch(fd, dirname(copy), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) : -1;
+    free(copy);
+    if (watch < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void file_watch_free(int fd)
+{
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+// Drain pending events, returns 1 if any of them was about filename
+int file_watch_changed(int fd, const char *filename)
+{
+    if (fd < 0)
+    {
+        return 0;
+    }
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    ssize_t length;
+    while ((length = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (char *p = buffer; p < buffer + length;)
+        {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            if (event->len > 0 && strcmp(event->name, filename) == 0)
+            {
+                changed = 1;
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return changed;
+}
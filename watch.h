@@ -0,0 +1,14 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+/*
+Watch of the working tree file with inotify. The directory is watched
+rather than the file, since editors often save by writing a new file and
+renaming it over the old one, which would drop a watch on the file itself.
+*/
+
+int file_watch_init(const char *path);
+void file_watch_free(int fd);
+int file_watch_changed(int fd, const char *filename);
+
+#endif
@@ -1,11 +1,25 @@
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include "windows.h"
+#include "syntax.h"
+#include "search.h"
+#include "stats.h"
+#include "timer.h"
 
 #define DIFF_CONTEXT 0
 #define DIFF_ADDITION 1
 #define DIFF_DELETION 2
 
+// Color pair of each syntax token class, pairs are set up in app_init
+static const int token_color_pair[] = {0, 4, 5, 6, 7};
+
+static void commit_display_ensure_search(commit_display *display);
+
+// Ancestor search budget for one slice, small enough to keep input responsive
+#define SEARCH_SLICE_COMMITS 2000
+#define SEARCH_SLICE_MS 20
+
 commit_display *commit_display_init(int height, int width, int starty, int startx, commit_graph_walk_t *walk)
 {
     commit_display *display = malloc(sizeof(commit_display));
@@ -17,13 +31,30 @@ commit_display *commit_display_init(int height, int width, int starty, int start
     display->commit_info = newwin(2, width, starty, startx);
     display->file_content = newwin(height - 2, width, starty + 2, startx);
     refresh();
-    // display->y_offset = 0;
+    display->y_offset = 0;
     display->walk->current = walk->current;
+    display->walk->graph_file = walk->graph_file;
+    display->walk->prefetcher = walk->prefetcher;
+    display->walk->versions = walk->versions;
+    display->walk->shared_files = 1;
     display->menu_state = 0;
+    display->store = NULL;
     display->buffer = NULL;
     display->buffer_lines_count = 0;
+    display->rows = NULL;
+    display->rows_count = 0;
+    display->line_rows = NULL;
+    display->layout_width = 0;
+    display->layout_dirty = 1;
+    display->wrap = 1;
+    display->x_offset = 0;
+    display->max_line_width = 0;
+    display->tokens = NULL;
+    display->tokens_size = 0;
+    file_search_init(&display->search);
 
     wattron(display->commit_info, COLOR_PAIR(1));
+    keypad(display->commit_info, TRUE);
 
     return display;
 }
@@ -32,6 +63,17 @@ void commit_display_free(commit_display *display)
 {
     delwin(display->commit_info);
     delwin(display->file_content);
+    for (int i = 0; i < display->buffer_lines_count; i++)
+    {
+        free(display->buffer[i]);
+    }
+    stats.lines -= display->buffer_lines_count;
+    free(display->buffer);
+    line_store_release(display->store);
+    free(display->rows);
+    free(display->line_rows);
+    free(display->tokens);
+    file_search_free(&display->search);
     free(display->walk);
     free(display);
     display = NULL;
@@ -56,194 +98,523 @@ void commit_display_update_info(commit_display *display)
     {
         return;
     }
-    // clear window
-    wclear(display->commit_info);
+    // erase instead of clear, so only changed cells are sent to terminal
+    werase(display->commit_info);
     // print commit info
-    const git_oid *comit_oid = git_commit_id(display->walk->current->commit);
-    const char *message = git_commit_message(display->walk->current->commit);
-    int free = COLS - 8;
-    mvwprintw(display->commit_info, 0, 0, "Commit: %.*s", free, git_oid_tostr_s(comit_oid));
-    mvwprintw(display->commit_info, 1, 0, "Message: %s", message);
+    commit_graph_node_t *node = display->walk->current;
+    if (node->kind == NODE_COMMIT)
+    {
+        const git_oid *comit_oid = git_commit_id(node->commit);
+        const char *message = git_commit_message(node->commit);
+        int free = COLS - 8;
+        mvwprintw(display->commit_info, 0, 0, "Commit: %.*s", free, git_oid_tostr_s(comit_oid));
+        mvwprintw(display->commit_info, 1, 0, "Message: %s", message);
+    }
+    else
+    {
+        int changed = !git_oid_equal(&node->blob_id, commit_graph_node_blob_id(node->ancestors[0]));
+        mvwprintw(display->commit_info, 0, 0, "%s: %s", node->kind == NODE_WORKTREE ? "Working tree" : "Index", node->path);
+        mvwprintw(display->commit_info, 1, 0, "Message: %s", changed ? "(uncommitted changes)" : "(no changes)");
+    }
+    commit_display_update_search_progress(display);
+    commit_display_ensure_search(display);
+    if (display->search.query_length > 0)
+    {
+        int x = getmaxx(display->commit_info) - display->search.query_length - 16;
+        wmove(display->commit_info, 1, x > 0 ? x : 0);
+        wclrtoeol(display->commit_info);
+        wprintw(display->commit_info, " /%s %d/%d", display->search.query, display->search.current + 1, display->search.matches_count);
+    }
     wnoutrefresh(display->commit_info);
 }
 
-void commit_display_update_file(commit_display *display)
+// Format count with thousands separators, 35000 -> 35,000
+static void format_count(char *out, size_t count)
+{
+    char digits[32];
+    int length = snprintf(digits, sizeof(digits), "%zu", count);
+    int j = 0;
+    for (int i = 0; i < length; i++)
+    {
+        if (i > 0 && (length - i) % 3 == 0)
+        {
+            out[j++] = ',';
+        }
+        out[j++] = digits[i];
+    }
+    out[j] = '\0';
+}
+
+// Print state of unfinished ancestor search at the end of commit line
+void commit_display_update_search_progress(commit_display *display)
+{
+    commit_graph_node_t *node = commit_graph_node_commit(display->walk->current);
+    ancestor_search_t *search = node->search;
+    if (node->ancestors_fetched || !search)
+    {
+        return;
+    }
+    char count[48];
+    format_count(count, search->commits_searched);
+    int x = getmaxx(display->commit_info) - 40;
+    wmove(display->commit_info, 0, x > 48 ? x : 48);
+    wclrtoeol(display->commit_info);
+    if (search->paused)
+    {
+        wprintw(display->commit_info, " stopped at %s commits (c: continue)", count);
+    }
+    else
+    {
+        wprintw(display->commit_info, " searched %s commits... (x: stop)", count);
+    }
+}
+
+// Run one budgeted slice of ancestor search for displayed commit, or for
+// HEAD when index or working tree version is shown.
+// Returns 1 if search needs more slices.
+int commit_display_search_step(commit_display *display)
+{
+    if (!display || !commit_graph_search_active(commit_graph_node_commit(display->walk->current)))
+    {
+        return 0;
+    }
+    int result = commit_graph_fetch_ancestors_step(commit_graph_node_commit(display->walk->current), SEARCH_SLICE_COMMITS, SEARCH_SLICE_MS);
+    commit_display_update_info(display);
+    return result == FETCH_IN_PROGRESS;
+}
+
+// Show jump progress or move display to found target, result is from a
+// goto step. Returns 1 while history is still resolved, 0 when display was
+// moved and -1 on failure.
+static int goto_result(commit_display *display, int result, commit_graph_node_t *target)
+{
+    if (result == FETCH_IN_PROGRESS)
+    {
+        char count[48];
+        format_count(count, display->walk->versions->size);
+        int x = getmaxx(display->commit_info) - 40;
+        wmove(display->commit_info, 0, x > 48 ? x : 48);
+        wclrtoeol(display->commit_info);
+        wprintw(display->commit_info, " going back, %s versions found... (x: stop)", count);
+        wnoutrefresh(display->commit_info);
+        return 1;
+    }
+    if (result != FETCH_DONE)
+    {
+        return -1;
+    }
+    display->walk->current = target;
+    display->menu_state = 0;
+    display->y_offset = 0;
+    commit_display_load_buffer(display);
+    return 0;
+}
+
+// Run one budgeted slice of jump to version shown at given time. Only the
+// buffer of found version is loaded, versions passed on the way are not.
+// Returns 1 while history is still resolved, 0 when display was moved and
+// -1 on failure.
+int commit_display_goto_step(commit_display *display, git_time_t time)
+{
+    if (!display)
+    {
+        return -1;
+    }
+    commit_graph_node_t *target = NULL;
+    int result = commit_graph_goto_step(display->walk->versions, time, SEARCH_SLICE_COMMITS, SEARCH_SLICE_MS, &target);
+    return goto_result(display, result, target);
+}
+
+// Same for jump to version commit has, blob is the file in its tree
+int commit_display_goto_commit_step(commit_display *display, git_commit *commit, const git_oid *blob)
+{
+    if (!display)
+    {
+        return -1;
+    }
+    commit_graph_node_t *target = NULL;
+    int result = commit_graph_goto_commit_step(display->walk->versions, commit, blob, SEARCH_SLICE_COMMITS, SEARCH_SLICE_MS, &target);
+    return goto_result(display, result, target);
+}
+
+// Build row index mapping screen rows to buffer lines for current width.
+// Top shown line is kept in place so resize and wrap toggle don't lose position.
+void commit_display_build_layout(commit_display *display)
 {
     if (!display)
     {
         return;
     }
-    wclear(display->file_content);
-    int y = 0;
-    int max_y = getmaxy(display->file_content);
-    for (int i = display->y_offset; i < display->buffer_lines_count && y < max_y - 1; i++)
+    int width = getmaxx(display->file_content);
+    if (width < 1)
+    {
+        width = 1;
+    }
+    int top_line = -1;
+    int top_column = 0;
+    if (display->y_offset < display->rows_count && display->rows[display->y_offset].line < display->buffer_lines_count)
+    {
+        top_line = display->rows[display->y_offset].line;
+        top_column = display->rows[display->y_offset].column;
+    }
+
+    // count rows first so arrays are resized once
+    int rows_count = 0;
+    int max_line_width = 0;
+    for (int i = 0; i < display->buffer_lines_count; i++)
+    {
+        int line_width = display->buffer[i]->width;
+        max_line_width = line_width > max_line_width ? line_width : max_line_width;
+        rows_count += display->buffer[i]->lines_before;
+        rows_count += display->wrap && line_width > width ? (line_width + width - 1) / width : 1;
+    }
+    display->rows = realloc(display->rows, (rows_count > 0 ? rows_count : 1) * sizeof(visual_row));
+    display->line_rows = realloc(display->line_rows, (display->buffer_lines_count > 0 ? display->buffer_lines_count : 1) * sizeof(int));
+
+    int row = 0;
+    for (int i = 0; i < display->buffer_lines_count; i++)
     {
-        for (int j = 0; j < display->buffer[i]->lines_before && y < max_y - 1; j++)
+        display->line_rows[i] = row;
+        for (int j = 0; j < display->buffer[i]->lines_before; j++)
         {
-            wprintw(display->file_content, "\n");
-            y++;
+            display->rows[row].line = i;
+            display->rows[row++].column = -1;
         }
-        if (y >= max_y - 1)
+        int column = 0;
+        do
         {
-            break;
-        }
-        // Apply color based on diff mark
-        switch (display->buffer[i]->diif_mark)
+            display->rows[row].line = i;
+            display->rows[row++].column = column;
+            column += width;
+        } while (display->wrap && column < display->buffer[i]->width);
+    }
+    display->rows_count = rows_count;
+    display->max_line_width = max_line_width;
+    display->layout_width = width;
+    display->layout_dirty = 0;
+
+    if (top_line >= 0)
+    {
+        display->y_offset = display->line_rows[top_line];
+        if (top_column > 0 && display->wrap)
         {
-        case DIFF_ADDITION:
-            wattron(display->file_content, COLOR_PAIR(2)); // Green for additions
-            break;
-        case DIFF_DELETION:
-            wattron(display->file_content, COLOR_PAIR(3)); // Red for deletions
-            break;
+            display->y_offset += display->buffer[top_line]->lines_before + top_column / width;
         }
+    }
+    if (display->y_offset >= display->rows_count)
+    {
+        display->y_offset = display->rows_count > 0 ? display->rows_count - 1 : 0;
+    }
+    // shorter lines or wider window after version change or resize
+    int max_x_offset = max_line_width > width ? max_line_width - width : 0;
+    if (display->x_offset > max_x_offset)
+    {
+        display->x_offset = max_x_offset;
+    }
+}
 
-        // Print the line
-        wprintw(display->file_content, display->buffer[i]->text);
-
-        // Reset color
-        wattroff(display->file_content, COLOR_PAIR(2));
-        wattroff(display->file_content, COLOR_PAIR(3));
-
-        y = getcury(display->file_content);
+static void commit_display_ensure_layout(commit_display *display)
+{
+    if (display->layout_dirty || display->layout_width != getmaxx(display->file_content))
+    {
+        commit_display_build_layout(display);
     }
-    wnoutrefresh(display->file_content);
 }
 
-void commit_display_load_buffer(commit_display *display)
+// Matches are indexed lazily, after version change only when they are needed
+static void commit_display_ensure_search(commit_display *display)
 {
-    // get blob data
-    git_blob *blob = NULL;
-    git_blob_lookup(&blob, git_commit_owner(display->walk->current->commit), git_tree_entry_id(display->walk->current->entry));
-    size_t blob_size = git_blob_rawsize(blob);
-    const char *blob_content = git_blob_rawcontent(blob);
-    // count the number of lines in blob
-    size_t blob_lines = 0;
-    for (size_t i = 0; i < blob_size; i++)
-    {
-        if (blob_content[i] == '\n')
-        {
-            blob_lines++;
-        }
+    if (display->search.dirty)
+    {
+        file_search_index(&display->search, display->buffer, display->buffer_lines_count);
     }
-    blob_lines += (blob_size > 0 && blob_content[blob_size - 1] != '\n') ? 1 : 0;
+}
 
-    // free unused lines in buffer (terminal downsized)
-    for (int i = blob_lines; i < display->buffer_lines_count; i++)
+// Print part of line starting at first_column, at most columns wide.
+// Syntax colors from tokens are used only on lines without diff mark,
+// search matches starting from index match are highlighted on all lines.
+static void print_row(commit_display *display, int y, const visual_row *row, int first_column, int columns, const unsigned char *tokens, int match)
+{
+    line_data *line = display->buffer[row->line];
+    // Apply color based on diff mark
+    switch (line->diif_mark)
     {
-        free(display->buffer[i]->text);
-        free(display->buffer[i]);
+    case DIFF_ADDITION:
+        wattron(display->file_content, COLOR_PAIR(2)); // Green for additions
+        break;
+    case DIFF_DELETION:
+        wattron(display->file_content, COLOR_PAIR(3)); // Red for deletions
+        break;
     }
-    // reallocate to match lines in blob
-    display->buffer = realloc(display->buffer, blob_lines * sizeof(line_data *));
-    // allocate for each line (terminal upsized)
-    for (int i = display->buffer_lines_count; i < blob_lines; i++)
+
+    if (line->diif_mark != DIFF_CONTEXT)
     {
-        display->buffer[i] = malloc(sizeof(line_data));
+        tokens = NULL;
     }
-    display->buffer_lines_count = blob_lines;
 
-    // copying from blob to buffer
-    size_t line_start = 0;
-    size_t line_index = 0;
-    for (size_t i = 0; i < blob_size; i++)
+    wmove(display->file_content, y, 0);
+    int column = 0;
+    int last_column = first_column + columns;
+    for (int i = 0; i < line->length && line->text[i] != '\n' && column < last_column; i++)
     {
-        if (blob_content[i] == '\n' || i == blob_size - 1)
+        char c = line->text[i];
+        int char_width = c == '\t' ? TAB_WIDTH - column % TAB_WIDTH : 1;
+        chtype attributes = tokens ? COLOR_PAIR(token_color_pair[tokens[i]]) : 0;
+        while (match < display->search.matches_count && display->search.matches[match].line == row->line &&
+               display->search.matches[match].column + display->search.query_length <= i)
+        {
+            match++;
+        }
+        if (match < display->search.matches_count && display->search.matches[match].line == row->line &&
+            display->search.matches[match].column <= i)
+        {
+            attributes |= A_REVERSE;
+        }
+        for (int j = 0; j < char_width; j++, column++)
         {
-            size_t line_length = i + 1 - line_start;
-            display->buffer[line_index]->text = realloc(display->buffer[line_index]->text, line_length + 1);
-            memcpy(display->buffer[line_index]->text, blob_content + line_start, line_length);
-            display->buffer[line_index]->text[line_length] = '\0';
-            display->buffer[line_index]->length = line_length;
-
-            line_start += line_length;
-            display->buffer[line_index]->diif_mark = 0;
-            line_index++;
+            if (column >= first_column && column < last_column)
+            {
+                waddch(display->file_content, (c == '\t' ? ' ' : (isprint((unsigned char)c) ? c : '?')) | attributes);
+            }
         }
     }
 
-    git_blob_free(blob);
+    // Reset color
+    wattroff(display->file_content, COLOR_PAIR(2));
+    wattroff(display->file_content, COLOR_PAIR(3));
 }
 
-void commit_display_reset_diff(commit_display *display)
+void commit_display_update_file(commit_display *display)
 {
     if (!display)
     {
         return;
     }
-    for (int i = 0; i < display->buffer_lines_count; i++)
+    commit_display_ensure_layout(display);
+    commit_display_ensure_search(display);
+    werase(display->file_content);
+    int max_y = getmaxy(display->file_content);
+    int width = getmaxx(display->file_content);
+
+    // only visible lines are tokenized, starting from nearest cached checkpoint
+    const commit_graph_node_t *node = display->walk->current;
+    const syntax_language *language = syntax_language_for(commit_graph_node_name(node));
+    syntax_cache_entry *syntax = language ? syntax_cache_get(commit_graph_node_blob_id(node), language) : NULL;
+    int tokens_line = -1;
+    int state = SYNTAX_STATE_NORMAL;
+
+    for (int y = 0; y < max_y && display->y_offset + y < display->rows_count; y++)
     {
-        display->buffer[i]->diif_mark = DIFF_CONTEXT;
-        display->buffer[i]->lines_before = 0;
+        const visual_row *row = &display->rows[display->y_offset + y];
+        if (row->column < 0)
+        {
+            continue;
+        }
+        line_data *line = display->buffer[row->line];
+        if (syntax && row->line != tokens_line)
+        {
+            if (row->line != tokens_line + 1 || tokens_line < 0)
+            {
+                state = syntax_state_at(syntax, display->buffer, display->buffer_lines_count, row->line);
+            }
+            if (line->length > display->tokens_size)
+            {
+                unsigned char *tokens = realloc(display->tokens, line->length);
+                if (!tokens)
+                {
+                    perror("Failed to allocate memory for syntax tokens");
+                    exit(EXIT_FAILURE);
+                }
+                display->tokens = tokens;
+                display->tokens_size = line->length;
+            }
+            state = syntax_tokenize_line(language, state, line->text, line->length, display->tokens);
+            tokens_line = row->line;
+        }
+        int match = file_search_first_in_line(&display->search, row->line);
+        print_row(display, y, row, display->wrap ? row->column : display->x_offset, width, syntax ? display->tokens : NULL, match);
     }
+    wnoutrefresh(display->file_content);
 }
 
-void commit_display_get_diff(commit_display *old_display, commit_display *new_display)
+// Move shown rows by given amount, returns 0 if already at the edge
+int commit_display_scroll(commit_display *display, int rows)
 {
-    if (!old_display || !new_display)
+    commit_display_ensure_layout(display);
+    int max_offset = display->rows_count > 0 ? display->rows_count - 1 : 0;
+    int offset = display->y_offset + rows;
+    offset = offset < 0 ? 0 : (offset > max_offset ? max_offset : offset);
+    if (offset == display->y_offset)
     {
-        return;
+        return 0;
     }
-    git_blob *old_blob = NULL;
-    git_blob *new_blob = NULL;
-    git_blob_lookup(&old_blob, git_commit_owner(old_display->walk->current->commit), git_tree_entry_id(old_display->walk->current->entry));
-    git_blob_lookup(&new_blob, git_commit_owner(new_display->walk->current->commit), git_tree_entry_id(new_display->walk->current->entry));
-
-    commit_display_reset_diff(old_display);
-    commit_display_reset_diff(new_display);
+    display->y_offset = offset;
+    return 1;
+}
 
-    diff_payload *payload = malloc(sizeof(diff_payload));
-    payload->old_display = old_display;
-    payload->new_display = new_display;
-    payload->lines_sync = 0;
+int commit_display_scroll_page(commit_display *display, int pages)
+{
+    int page = getmaxy(display->file_content) - 1;
+    return commit_display_scroll(display, pages * (page > 0 ? page : 1));
+}
 
-    git_diff_blobs(old_blob, NULL, new_blob, NULL, NULL, NULL, NULL, NULL, diff_line_cb, payload);
+int commit_display_scroll_horizontal(commit_display *display, int columns)
+{
+    if (display->wrap)
+    {
+        return 0;
+    }
+    commit_display_ensure_layout(display);
+    // text starts at first column of window, so the widest line ends at
+    // its right edge
+    int width = getmaxx(display->file_content);
+    int max_offset = display->max_line_width > width ? display->max_line_width - width : 0;
+    int offset = display->x_offset + columns;
+    offset = offset < 0 ? 0 : (offset > max_offset ? max_offset : offset);
+    if (offset == display->x_offset)
+    {
+        return 0;
+    }
+    display->x_offset = offset;
+    return 1;
+}
 
-    git_blob_free(old_blob);
-    git_blob_free(new_blob);
-    free(payload);
+// Show line (counted from 1) at top of the window, returns 0 if there is no such line
+int commit_display_goto_line(commit_display *display, int line)
+{
+    commit_display_ensure_layout(display);
+    if (line < 1 || line > display->buffer_lines_count)
+    {
+        return 0;
+    }
+    display->y_offset = display->line_rows[line - 1] + display->buffer[line - 1]->lines_before;
+    return 1;
 }
 
-int diff_line_cb(const git_diff_delta *delta, const git_diff_hunk *hunk, const git_diff_line *line, void *payload)
+void commit_display_toggle_wrap(commit_display *display)
 {
-    diff_payload *diff_data = (diff_payload *)payload;
-    commit_display *old_display = diff_data->old_display;
-    commit_display *new_display = diff_data->new_display;
+    display->wrap = !display->wrap;
+    display->x_offset = 0;
+    commit_display_build_layout(display);
+}
 
-    switch (line->origin)
+// Read a line of text from user on second info line, returns 0 if cancelled
+// on_change, if not NULL, is called after every edit of the text.
+// Keys come from read_key of the backend, running out of them cancels.
+int commit_display_prompt(commit_display *display, const char *prompt, char *out, int size, void (*on_change)(commit_display *display, const char *text), int (*read_key)(int timeout_ms))
+{
+    int length = 0;
+    int ch = 0;
+    out[0] = '\0';
+    curs_set(1);
+    while (1)
     {
-    case GIT_DIFF_LINE_ADDITION:
-    case GIT_DIFF_LINE_ADD_EOFNL:
-        if (line->new_lineno > 0 && line->new_lineno <= new_display->buffer_lines_count)
+        wmove(display->commit_info, 1, 0);
+        wclrtoeol(display->commit_info);
+        wprintw(display->commit_info, "%s%s", prompt, out);
+        wrefresh(display->commit_info);
+        ch = read_key(-1);
+        if (ch == ERR)
         {
-            new_display->buffer[line->new_lineno - 1]->diif_mark = DIFF_ADDITION;
-            diff_data->lines_sync++;
+            ch = 27;
         }
-        break;
-    case GIT_DIFF_LINE_DELETION:
-    case GIT_DIFF_LINE_DEL_EOFNL:
-        if (line->old_lineno > 0 && line->old_lineno <= old_display->buffer_lines_count)
+        if (ch == '\n' || ch == KEY_ENTER || ch == 27)
         {
-            old_display->buffer[line->old_lineno - 1]->diif_mark = DIFF_DELETION;
-            diff_data->lines_sync--;
+            break;
         }
-        break;
-    case GIT_DIFF_LINE_CONTEXT:
-        if (line->old_lineno > 0 && line->old_lineno <= old_display->buffer_lines_count)
+        if ((ch == KEY_BACKSPACE || ch == 127 || ch == 8) && length > 0)
         {
-            old_display->buffer[line->old_lineno - 1]->diif_mark = DIFF_CONTEXT;
-            old_display->buffer[line->old_lineno - 1]->lines_before = diff_data->lines_sync > 0 ? diff_data->lines_sync : 0;
+            out[--length] = '\0';
         }
-        if (line->new_lineno > 0 && line->new_lineno <= new_display->buffer_lines_count)
+        else if (ch < 256 && isprint(ch) && length < size - 1)
         {
-            new_display->buffer[line->new_lineno - 1]->diif_mark = DIFF_CONTEXT;
-            new_display->buffer[line->new_lineno - 1]->lines_before = diff_data->lines_sync < 0 ? -diff_data->lines_sync : 0;
+            out[length++] = ch;
+            out[length] = '\0';
+        }
+        else
+        {
+            continue;
+        }
+        if (on_change)
+        {
+            on_change(display, out);
+            doupdate();
         }
-        diff_data->lines_sync = 0;
-        break;
     }
+    curs_set(0);
+    commit_display_update_info(display);
+    return ch != 27;
+}
 
-    return 0;
+// Set new search query and show first match from top of the window
+void commit_display_search_update(commit_display *display, const char *query)
+{
+    file_search_set_query(&display->search, query);
+    display->search.current = -1;
+    commit_display_search_jump(display, 1);
+    commit_display_update_file(display);
+}
+
+// Jump to next or previous match, returns 0 if there are none
+int commit_display_search_jump(commit_display *display, int direction)
+{
+    commit_display_ensure_layout(display);
+    commit_display_ensure_search(display);
+    file_search *search = &display->search;
+    int line = display->y_offset < display->rows_count ? display->rows[display->y_offset].line : 0;
+    int column = -1;
+    if (search->current >= 0)
+    {
+        line = search->matches[search->current].line;
+        column = search->matches[search->current].column;
+    }
+    int index = file_search_find(search, line, column, direction);
+    if (index < 0)
+    {
+        return 0;
+    }
+    search->current = index;
+    commit_display_goto_line(display, search->matches[index].line + 1);
+    return 1;
+}
+
+// Show lines of current version, they come from line store shared by all
+// panes so blob is read and split only when no pane showed it recently
+void commit_display_load_buffer(commit_display *display)
+{
+    double start = timer_now_ms();
+    line_store_entry *store = line_store_get(display->walk->current);
+    line_store_release(display->store);
+    display->store = store;
+
+    // free unused lines in buffer (version has less lines)
+    for (int i = store->lines_count; i < display->buffer_lines_count; i++)
+    {
+        free(display->buffer[i]);
+    }
+    // reallocate to match lines in blob
+    display->buffer = realloc(display->buffer, (store->lines_count ? store->lines_count : 1) * sizeof(line_data *));
+    // allocate for each line (version has more lines)
+    for (int i = display->buffer_lines_count; i < store->lines_count; i++)
+    {
+        display->buffer[i] = malloc(sizeof(line_data));
+    }
+    stats.lines += store->lines_count - display->buffer_lines_count;
+    display->buffer_lines_count = store->lines_count;
+
+    for (int i = 0; i < store->lines_count; i++)
+    {
+        display->buffer[i]->text = store->lines[i].text;
+        display->buffer[i]->length = store->lines[i].length;
+        display->buffer[i]->width = store->lines[i].width;
+        display->buffer[i]->diif_mark = DIFF_CONTEXT;
+        display->buffer[i]->lines_before = 0;
+    }
+
+    display->layout_dirty = 1;
+    display->search.dirty = display->search.query_length > 0;
+    stats.blob_load_ms += timer_now_ms() - start;
+    stats.blob_loads++;
 }
 
 void commit_display_update_menu(commit_display *display)
@@ -276,26 +647,143 @@ void commit_display_update_menu(commit_display *display)
     wnoutrefresh(display->file_content);
 }
 
-void handle_resize(commit_display *l_display, commit_display *r_display)
+void pane_diff_init(pane_diff *diff)
+{
+    memset(diff, 0, sizeof(pane_diff));
+}
+
+void pane_diff_free(pane_diff *diff)
+{
+    free(diff->old_deleted);
+    free(diff->old_padding);
+    free(diff->new_added);
+    free(diff->new_padding);
+    pane_diff_init(diff);
+}
+
+static int pane_diff_line_cb(const git_diff_delta *delta, const git_diff_hunk *hunk, const git_diff_line *line, void *payload)
+{
+    pane_diff *diff = (pane_diff *)payload;
+    int old_line = line->old_lineno - 1;
+    int new_line = line->new_lineno - 1;
+    int old_valid = line->old_lineno > 0 && old_line < diff->old_count;
+    int new_valid = line->new_lineno > 0 && new_line < diff->new_count;
+
+    switch (line->origin)
+    {
+    case GIT_DIFF_LINE_ADDITION:
+    case GIT_DIFF_LINE_ADD_EOFNL:
+        if (new_valid)
+        {
+            diff->new_added[new_line] = 1;
+            diff->lines_sync++;
+        }
+        break;
+    case GIT_DIFF_LINE_DELETION:
+    case GIT_DIFF_LINE_DEL_EOFNL:
+        if (old_valid)
+        {
+            diff->old_deleted[old_line] = 1;
+            diff->lines_sync--;
+        }
+        break;
+    case GIT_DIFF_LINE_CONTEXT:
+        if (old_valid)
+        {
+            diff->old_padding[old_line] = diff->lines_sync > 0 ? diff->lines_sync : 0;
+        }
+        if (new_valid)
+        {
+            diff->new_padding[new_line] = diff->lines_sync < 0 ? -diff->lines_sync : 0;
+        }
+        diff->lines_sync = 0;
+        break;
+    }
+
+    return 0;
+}
+
+// Diff blobs of two adjacent panes unless they are the ones diffed last
+// time. Returns 1 if diff was recomputed.
+int pane_diff_update(pane_diff *diff, commit_display *old_display, commit_display *new_display)
+{
+    line_store_entry *old_store = old_display->store;
+    line_store_entry *new_store = new_display->store;
+    if (diff->valid && git_oid_equal(&diff->old_id, &old_store->blob_id) && git_oid_equal(&diff->new_id, &new_store->blob_id))
+    {
+        return 0;
+    }
+    double start = timer_now_ms();
+    git_oid_cpy(&diff->old_id, &old_store->blob_id);
+    git_oid_cpy(&diff->new_id, &new_store->blob_id);
+    diff->old_count = old_store->lines_count;
+    diff->new_count = new_store->lines_count;
+    diff->old_deleted = realloc(diff->old_deleted, diff->old_count + 1);
+    diff->old_padding = realloc(diff->old_padding, (diff->old_count + 1) * sizeof(int));
+    diff->new_added = realloc(diff->new_added, diff->new_count + 1);
+    diff->new_padding = realloc(diff->new_padding, (diff->new_count + 1) * sizeof(int));
+    memset(diff->old_deleted, 0, diff->old_count);
+    memset(diff->old_padding, 0, diff->old_count * sizeof(int));
+    memset(diff->new_added, 0, diff->new_count);
+    memset(diff->new_padding, 0, diff->new_count * sizeof(int));
+    diff->lines_sync = 0;
+
+    // buffers instead of blobs, so virtual index and working tree nodes diff too
+    git_diff_buffers(old_store->data, old_store->size, NULL, new_store->data, new_store->size, NULL, NULL, NULL, NULL, NULL, pane_diff_line_cb, diff);
+    diff->valid = 1;
+    stats.diff_ms += timer_now_ms() - start;
+    stats.diffs++;
+    return 1;
+}
+
+// Mark lines of display from diffs with its neighbours, additions against
+// left pane and deletions against right one. Padding aligns context lines
+// and is only used with two panes, where there is a single diff to align to.
+void commit_display_apply_diff(commit_display *display, const pane_diff *left, const pane_diff *right, int padding)
+{
+    for (int i = 0; i < display->buffer_lines_count; i++)
+    {
+        line_data *line = display->buffer[i];
+        line->diif_mark = DIFF_CONTEXT;
+        line->lines_before = 0;
+        if (left && left->valid && i < left->new_count)
+        {
+            line->diif_mark = left->new_added[i] ? DIFF_ADDITION : DIFF_CONTEXT;
+            line->lines_before = padding ? left->new_padding[i] : 0;
+        }
+        if (right && right->valid && i < right->old_count)
+        {
+            if (line->diif_mark == DIFF_CONTEXT && right->old_deleted[i])
+            {
+                line->diif_mark = DIFF_DELETION;
+            }
+            line->lines_before = padding ? right->old_padding[i] : line->lines_before;
+        }
+    }
+    display->layout_dirty = 1;
+}
+
+// Lay panes out side by side, separated by one column
+void handle_resize(commit_display **displays, int count)
 {
     endwin();
     clear();
     refresh();
-    if (l_display)
+    int width = (COLS - (count - 1)) / count;
+    for (int i = 0; i < count; i++)
     {
-        wresize(l_display->commit_info, 2, r_display ? COLS / 2 : COLS);
-        mvwin(l_display->commit_info, 0, 0);
-        wresize(l_display->file_content, LINES - 2, r_display ? COLS / 2 : COLS);
-        mvwin(l_display->file_content, 2, 0);
-        commit_display_update(l_display);
-    }
-    if (r_display)
-    {
-        wresize(r_display->commit_info, 2, (COLS - 1) / 2);
-        mvwin(r_display->commit_info, 0, COLS / 2 + 1);
-        wresize(r_display->file_content, LINES - 2, (COLS - 1) / 2);
-        mvwin(r_display->file_content, 2, COLS / 2 + 1);
-        commit_display_update(r_display);
+        commit_display *display = displays[i];
+        int x = i * (width + 1);
+        int pane_width = i == count - 1 ? COLS - x : width;
+        wresize(display->commit_info, 2, pane_width);
+        mvwin(display->commit_info, 0, x);
+        wresize(display->file_content, LINES - 2, pane_width);
+        mvwin(display->file_content, 2, x);
+        if (display->layout_width != getmaxx(display->file_content))
+        {
+            commit_display_build_layout(display);
+        }
+        commit_display_update(display);
     }
     doupdate();
 }
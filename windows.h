@@ -3,44 +3,106 @@
 
 #include <ncurses.h>
 #include "commit_graph_walk.h"
+#include "line_store.h"
 
 typedef struct
 {
-    char *text;
+    const char *text; // borrowed from line store entry of display
     int length;
+    int width; // display columns of text, tabs expanded, without newline
     int diif_mark;
     int lines_before;
 } line_data;
 
+// One screen row of file content
+typedef struct
+{
+    int line;   // index of buffer line shown in this row
+    int column; // first display column of the line in this row, -1 for padding row before line
+} visual_row;
+
+typedef struct
+{
+    int line;   // index of buffer line
+    int column; // byte offset of match in line text
+} search_match;
+
+// In-file search, query is kept when display moves to other version
+typedef struct
+{
+    char query[128];
+    int query_length;
+    search_match *matches; // sorted by line and column
+    int matches_count;
+    int matches_capacity;
+    int current;           // index of last jumped to match, -1 if none
+    int dirty;             // buffer changed since matches were indexed
+} file_search;
+
 typedef struct
 {
     WINDOW *commit_info;
     WINDOW *file_content;
     commit_graph_walk_t *walk;
+    line_store_entry *store; // shared lines of shown version
     line_data **buffer;
     int buffer_lines_count;
-    int y_offset;
+    visual_row *rows;   // layout of buffer on screen, padding and wrapping included
+    int rows_count;
+    int *line_rows;     // index of first row (first padding row) of each buffer line
+    int layout_width;   // width layout was built for
+    int layout_dirty;   // buffer or padding changed since layout was built
+    int wrap;           // wrap long lines, otherwise scroll horizontally
+    int x_offset;       // first shown column when not wrapping
+    int max_line_width; // widest buffer line, limits x_offset
+    int y_offset;       // first shown row
+    unsigned char *tokens; // syntax token classes of currently printed line
+    int tokens_size;
+    file_search search;
     int menu_state;
 } commit_display;
 
+// Diff between two adjacent panes, recomputed only when one of them
+// shows another blob
 typedef struct
 {
-    commit_display *old_display;
-    commit_display *new_display;
-    int lines_sync;
-} diff_payload;
+    git_oid old_id;
+    git_oid new_id;
+    int valid;
+    unsigned char *old_deleted; // per line of old pane
+    int *old_padding;           // rows to insert before line of old pane to align it
+    int old_count;
+    unsigned char *new_added;   // per line of new pane
+    int *new_padding;
+    int new_count;
+    int lines_sync;             // used while diff runs
+} pane_diff;
 
 commit_display *commit_display_init(int height, int width, int starty, int startx, commit_graph_walk_t *walk);
 void commit_display_free(commit_display *display);
 void commit_display_load_buffer(commit_display *display);
 void commit_display_update(commit_display *display);
 void commit_display_update_info(commit_display *display);
+void commit_display_update_search_progress(commit_display *display);
+int commit_display_search_step(commit_display *display);
+int commit_display_goto_step(commit_display *display, git_time_t time);
+int commit_display_goto_commit_step(commit_display *display, git_commit *commit, const git_oid *blob);
 void commit_display_update_file(commit_display *display);
 void commit_display_update_menu(commit_display *display);
-void handle_resize(commit_display *l_display, commit_display *r_display);
-void commit_display_get_diff(commit_display *old_display, commit_display *new_display);
-void commit_display_reset_diff(commit_display *display);
-int diff_line_cb(const git_diff_delta *delta, const git_diff_hunk *hunk, const git_diff_line *line, void *payload);
+void commit_display_build_layout(commit_display *display);
+int commit_display_scroll(commit_display *display, int rows);
+int commit_display_scroll_page(commit_display *display, int pages);
+int commit_display_scroll_horizontal(commit_display *display, int columns);
+int commit_display_goto_line(commit_display *display, int line);
+void commit_display_toggle_wrap(commit_display *display);
+int commit_display_prompt(commit_display *display, const char *prompt, char *out, int size, void (*on_change)(commit_display *display, const char *text), int (*read_key)(int timeout_ms));
+void commit_display_search_update(commit_display *display, const char *query);
+int commit_display_search_jump(commit_display *display, int direction);
+void handle_resize(commit_display **displays, int count);
+void pane_diff_init(pane_diff *diff);
+void pane_diff_free(pane_diff *diff);
+int pane_diff_update(pane_diff *diff, commit_display *old_display, commit_display *new_display);
+void commit_display_apply_diff(commit_display *display, const pane_diff *left, const pane_diff *right, int padding);
 
 
 #endif